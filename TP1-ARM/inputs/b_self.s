@@ -0,0 +1,6 @@
+.text
+// Spins forever: --detect-loops stops it with exit code 4.
+spin:
+b spin
+
+HLT 0
@@ -0,0 +1,7 @@
+.text
+// Z is set, so b.eq spins: --detect-loops stops it with exit code 4.
+cmp X11, X11
+spin:
+beq spin
+
+HLT 0
@@ -0,0 +1,2 @@
+14000000 
+d4400000 
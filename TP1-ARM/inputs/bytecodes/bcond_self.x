@@ -0,0 +1,3 @@
+eb0b017f 
+54000000 
+d4400000 
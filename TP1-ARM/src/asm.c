@@ -0,0 +1,1167 @@
+/**
+ * @file asm.c
+ * @brief Built-in assembler for the AArch64 subset the simulator runs.
+ *
+ * Each statement is parsed into a list of operands and handed to the
+ * encoder of its mnemonic. Branches and literals that name a label get a
+ * fixup, resolved after the last statement.
+ */
+
+#include "asm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+
+#define MAX_OPERANDS 5
+#define NOP_WORD     0xD503201F
+#define UNDEFINED    UINT64_MAX
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ASSEMBLER STATE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+enum { OP_REG, OP_IMM, OP_SHIFT, OP_MEM, OP_LABEL };
+enum { SHIFT_LSL, SHIFT_LSR, SHIFT_ASR, SHIFT_ROR };
+enum { FIX_IMM26, FIX_IMM19, FIX_ABS32 };
+
+/**
+ * @struct Operand
+ * @brief One parsed operand.
+ */
+typedef struct {
+    int kind;         ///< OP_*
+    int reg;          ///< Register number, or the base of OP_MEM (31 for sp/zr)
+    int wide;         ///< X register (as opposed to W)
+    int sp;           ///< Register was sp/wsp
+    int zr;           ///< Register was xzr/wzr
+    int shift;        ///< SHIFT_* for OP_SHIFT
+    int64_t imm;      ///< Immediate, shift amount or OP_MEM offset
+    int label;        ///< Label index for OP_LABEL
+} Operand;
+
+typedef struct {
+    uint64_t offset;  ///< Byte offset of the word to patch
+    int kind;         ///< FIX_*
+    int label;
+    int line;
+} Fixup;
+
+typedef struct {
+    uint64_t base;
+    uint8_t *out;
+    uint64_t room, size;
+    int line;
+    const char *error;
+
+    AsmLabel *labels;
+    int nlabels, labels_cap;
+    int *table;              ///< Open-addressed label index (-1 = empty)
+    int table_cap;
+
+    Fixup *fixups;
+    int nfixups, fixups_cap;
+
+    int *lines;              ///< Source line of each emitted word
+    uint64_t lines_cap;
+} Asm;
+
+typedef struct Mnemonic Mnemonic;
+typedef int (*encode_fn)(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word);
+
+struct Mnemonic {
+    const char *name;
+    encode_fn encode;
+    uint32_t arg;     ///< Variant bits for the encoder
+};
+
+/**
+ * @brief Records an error for the current statement.
+ */
+static int fail(Asm *a, const char *msg) {
+    if (a->error == NULL)
+        a->error = msg;
+    return ASM_ERR_SYNTAX;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * LABELS AND FIXUPS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static uint32_t label_hash(const char *name, int len) {
+    uint32_t h = 2166136261u;
+    while (len--)
+        h = (h ^ (uint8_t) *name++) * 16777619u;
+    return h;
+}
+
+/**
+ * @brief Index of a label, creating it (undefined) on first mention.
+ */
+static int label_find(Asm *a, const char *name, int len) {
+    int i;
+
+    if (2 * (a->nlabels + 1) > a->table_cap) {
+        int cap = a->table_cap ? 2 * a->table_cap : 64;
+        free(a->table);
+        a->table = malloc(cap * sizeof(int));
+        a->table_cap = cap;
+        memset(a->table, -1, cap * sizeof(int));
+        for (i = 0; i < a->nlabels; i++) {
+            uint32_t h = label_hash(a->labels[i].name, strlen(a->labels[i].name));
+            while (a->table[h & (cap - 1)] >= 0)
+                h++;
+            a->table[h & (cap - 1)] = i;
+        }
+    }
+
+    uint32_t h = label_hash(name, len);
+    int *slot;
+    while (*(slot = &a->table[h & (a->table_cap - 1)]) >= 0) {
+        const char *other = a->labels[*slot].name;
+        if (strncmp(other, name, len) == 0 && other[len] == '\0')
+            return *slot;
+        h++;
+    }
+
+    if (a->nlabels == a->labels_cap) {
+        a->labels_cap = a->labels_cap ? 2 * a->labels_cap : 32;
+        a->labels = realloc(a->labels, a->labels_cap * sizeof(AsmLabel));
+    }
+    a->labels[a->nlabels].name = strndup(name, len);
+    a->labels[a->nlabels].addr = UNDEFINED;
+    return *slot = a->nlabels++;
+}
+
+/**
+ * @brief Remembers that the word about to be emitted refers to a label.
+ */
+static void fixup_add(Asm *a, int kind, int label) {
+    if (a->nfixups == a->fixups_cap) {
+        a->fixups_cap = a->fixups_cap ? 2 * a->fixups_cap : 32;
+        a->fixups = realloc(a->fixups, a->fixups_cap * sizeof(Fixup));
+    }
+    a->fixups[a->nfixups++] = (Fixup) { a->size, kind, label, a->line };
+}
+
+/**
+ * @brief Patches every label reference once all labels are known.
+ */
+static int fixups_resolve(Asm *a) {
+    int i;
+
+    for (i = 0; i < a->nfixups; i++) {
+        const Fixup *f = &a->fixups[i];
+        uint64_t target = a->labels[f->label].addr;
+        uint8_t *p = a->out + f->offset;
+        uint32_t word = p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+        int64_t delta = (int64_t) (target - (a->base + f->offset)) >> 2;
+
+        a->line = f->line;
+        if (target == UNDEFINED)
+            return fail(a, "undefined label");
+
+        if (f->kind == FIX_IMM26) {
+            if (delta < -(1 << 25) || delta >= (1 << 25))
+                return fail(a, "branch target out of range");
+            word |= delta & 0x3FFFFFF;
+        } else if (f->kind == FIX_IMM19) {
+            if (delta < -(1 << 18) || delta >= (1 << 18))
+                return fail(a, "branch target out of range");
+            word |= (delta & 0x7FFFF) << 5;
+        } else {
+            word = (uint32_t) target;
+        }
+
+        p[0] = word;
+        p[1] = word >> 8;
+        p[2] = word >> 16;
+        p[3] = word >> 24;
+    }
+    return ASM_OK;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * OPERAND PARSING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int is_ident(char c) {
+    return isalnum((unsigned char) c) || c == '_' || c == '.' || c == '$';
+}
+
+static const char *skip_space(const char *p) {
+    while (*p == ' ' || *p == '\t' || *p == '\r')
+        p++;
+    return p;
+}
+
+/**
+ * @brief Recognizes x0-x30, w0-w30, xzr, wzr, sp and wsp.
+ */
+static int parse_register(const char *s, int len, Operand *op) {
+    char name[8];
+    int i;
+
+    if (len < 2 || len > 3)
+        return 0;
+    for (i = 0; i < len; i++)
+        name[i] = tolower((unsigned char) s[i]);
+    name[len] = '\0';
+
+    memset(op, 0, sizeof(*op));
+    op->kind = OP_REG;
+    if (strcmp(name, "sp") == 0 || strcmp(name, "wsp") == 0) {
+        op->reg = 31;
+        op->wide = name[0] == 's';
+        op->sp = 1;
+        return 1;
+    }
+    if (name[0] != 'x' && name[0] != 'w')
+        return 0;
+    op->wide = name[0] == 'x';
+    if (strcmp(name + 1, "zr") == 0) {
+        op->reg = 31;
+        op->zr = 1;
+        return 1;
+    }
+    if (!isdigit((unsigned char) name[1]) || (len == 3 && (name[1] == '0' ||
+            !isdigit((unsigned char) name[2]))))
+        return 0;
+    op->reg = atoi(name + 1);
+    return op->reg <= 30;
+}
+
+/**
+ * @brief Parses an immediate: optional '#', sign, then a C-style number.
+ */
+static const char *parse_number(const char *p, int64_t *value) {
+    int neg = 0;
+    char *end;
+
+    p = skip_space(p);
+    if (*p == '#')
+        p = skip_space(p + 1);
+    if (*p == '-' || *p == '+') {
+        neg = *p == '-';
+        p = skip_space(p + 1);
+    }
+    if (!isdigit((unsigned char) *p))
+        return NULL;
+
+    uint64_t v = (p[0] == '0' && (p[1] == 'b' || p[1] == 'B')) ?
+        strtoull(p + 2, &end, 2) : strtoull(p, &end, 0);
+    if (is_ident(*end))
+        return NULL;
+    *value = neg ? -(int64_t) v : (int64_t) v;
+    return end;
+}
+
+/**
+ * @brief Parses one operand and the separator after it.
+ */
+static const char *parse_operand(Asm *a, const char *p, Operand *op) {
+    p = skip_space(p);
+    memset(op, 0, sizeof(*op));
+
+    if (*p == '[') {
+        Operand base;
+        const char *s = skip_space(p + 1);
+        p = s;
+        while (is_ident(*p))
+            p++;
+        if (!parse_register(s, p - s, &base) || !base.wide || base.zr)
+            return fail(a, "expected a base register"), NULL;
+        *op = base;
+        op->kind = OP_MEM;
+        p = skip_space(p);
+        if (*p == ',' && (p = parse_number(p + 1, &op->imm)) == NULL)
+            return fail(a, "expected an offset"), NULL;
+        p = skip_space(p);
+        if (*p != ']')
+            return fail(a, "expected ']'"), NULL;
+        p = skip_space(p + 1);
+        if (*p == '!')
+            return fail(a, "pre-indexed addressing is not supported"), NULL;
+        return p;
+    }
+
+    if (*p == '#' || *p == '-' || *p == '+' || isdigit((unsigned char) *p)) {
+        op->kind = OP_IMM;
+        if ((p = parse_number(p, &op->imm)) == NULL)
+            return fail(a, "bad immediate"), NULL;
+        return skip_space(p);
+    }
+
+    const char *s = p;
+    while (is_ident(*p))
+        p++;
+    if (p == s)
+        return fail(a, "expected an operand"), NULL;
+    if (parse_register(s, p - s, op))
+        return skip_space(p);
+
+    static const char *shifts[] = { "lsl", "lsr", "asr", "ror" };
+    for (int k = 0; k < 4 && p - s == 3; k++) {
+        if (strncasecmp(s, shifts[k], 3) != 0)
+            continue;
+        op->kind = OP_SHIFT;
+        op->shift = k;
+        if ((p = parse_number(p, &op->imm)) == NULL)
+            return fail(a, "expected a shift amount"), NULL;
+        return skip_space(p);
+    }
+
+    if (isdigit((unsigned char) *s))
+        return fail(a, "bad operand"), NULL;
+    op->kind = OP_LABEL;
+    op->label = label_find(a, s, p - s);
+    return skip_space(p);
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ENCODING HELPERS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int is_reg(const Operand *op) {
+    return op->kind == OP_REG;
+}
+
+/**
+ * @brief A general register of the given width: not sp, zr allowed.
+ */
+static int is_gpr(const Operand *op, int wide) {
+    return op->kind == OP_REG && !op->sp && op->wide == wide;
+}
+
+/**
+ * @brief Register or sp of the given width: not zr.
+ */
+static int is_gpr_sp(const Operand *op, int wide) {
+    return op->kind == OP_REG && !op->zr && op->wide == wide;
+}
+
+/**
+ * @brief Reads an optional trailing "lsl|lsr|asr|ror #n" operand.
+ */
+static int optional_shift(Asm *a, Operand *ops, int n, int at, int width,
+                          int allow_ror, int *type, int *amount) {
+    *type = SHIFT_LSL;
+    *amount = 0;
+    if (n == at)
+        return ASM_OK;
+    if (n != at + 1 || ops[at].kind != OP_SHIFT)
+        return fail(a, "unexpected operand");
+    if (ops[at].shift == SHIFT_ROR && !allow_ror)
+        return fail(a, "ror is not allowed here");
+    if (ops[at].imm < 0 || ops[at].imm >= width)
+        return fail(a, "shift amount out of range");
+    *type = ops[at].shift;
+    *amount = ops[at].imm;
+    return ASM_OK;
+}
+
+/**
+ * @brief Encodes a logical immediate as N:immr:imms, the way the
+ *        architecture defines bitmask immediates.
+ *
+ * @return int 1 if imm is a rotated run of ones repeated across the width.
+ */
+static int encode_bitmask(uint64_t imm, int width, uint32_t *bits) {
+    int size = 64, ones, r;
+
+    if (width == 32) {
+        imm &= 0xFFFFFFFFull;
+        imm |= imm << 32;
+    }
+    if (imm == 0 || imm == ~0ull)
+        return 0;
+
+    // Smallest repeating element.
+    while (size > 2) {
+        int half = size / 2;
+        uint64_t mask = (1ull << half) - 1;
+        if ((imm & mask) != ((imm >> half) & mask))
+            break;
+        size = half;
+    }
+
+    uint64_t mask = size == 64 ? ~0ull : (1ull << size) - 1;
+    uint64_t elt = imm & mask;
+    ones = __builtin_popcountll(elt);
+    uint64_t run = (1ull << ones) - 1;
+
+    // Rotation that brings the run of ones down to bit 0.
+    for (r = 0; r < size; r++) {
+        uint64_t rot = r ? ((elt >> r) | (elt << (size - r))) & mask : elt;
+        if (rot == run)
+            break;
+    }
+    if (r == size)
+        return 0;
+
+    uint32_t immr = (size - r) % size;
+    uint32_t imms = ((0u - 2 * size) | (ones - 1)) & 0x3F;
+    *bits = ((size == 64) << 22) | (immr << 16) | (imms << 10);
+    return 1;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * INSTRUCTION ENCODERS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define ARG_SUB     0x01   ///< add/sub: subtract
+#define ARG_FLAGS   0x02   ///< add/sub: set flags
+#define ARG_NO_RD   0x04   ///< cmp/cmn/tst: destination is zr
+#define ARG_NO_RN   0x08   ///< neg/mvn: first source is zr
+#define ARG_INVERT  0x10   ///< bic/orn/eon/bics: negate the second source
+
+/**
+ * @brief Fills in the implicit zr operand of cmp/cmn/tst/neg/mvn.
+ */
+static int implicit_zr(Operand *ops, int n, uint32_t arg) {
+    int at = (arg & ARG_NO_RD) ? 0 : (arg & ARG_NO_RN) ? 1 : -1;
+
+    if (at < 0 || n < 1 || n >= MAX_OPERANDS)
+        return n;
+    memmove(&ops[at + 1], &ops[at], (n - at) * sizeof(Operand));
+    memset(&ops[at], 0, sizeof(Operand));
+    ops[at].kind = OP_REG;
+    ops[at].reg = 31;
+    ops[at].zr = 1;
+    ops[at].wide = ops[at + 1].wide;
+    return n + 1;
+}
+
+/**
+ * @brief add, adds, sub, subs, cmp, cmn, neg, negs.
+ */
+static int enc_addsub(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    int sub = m->arg & ARG_SUB, flags = (m->arg & ARG_FLAGS) != 0;
+    int type, amount;
+
+    n = implicit_zr(ops, n, m->arg);
+    if (n < 3 || !is_reg(&ops[0]))
+        return fail(a, "expected registers");
+    int sf = ops[0].wide, width = sf ? 64 : 32;
+    uint32_t head = ((uint32_t) sf << 31) | ((uint32_t) (sub != 0) << 30) | (flags << 29);
+
+    if (ops[2].kind == OP_IMM) {
+        int64_t imm = ops[2].imm;
+        int sh = 0;
+
+        if ((flags ? !is_gpr(&ops[0], sf) : !is_gpr_sp(&ops[0], sf)) ||
+                !is_gpr_sp(&ops[1], sf))
+            return fail(a, "bad register for an immediate add/sub");
+        if (n == 4) {
+            if (ops[3].kind != OP_SHIFT || ops[3].shift != SHIFT_LSL ||
+                    (ops[3].imm != 0 && ops[3].imm != 12))
+                return fail(a, "shift must be lsl #0 or lsl #12");
+            sh = ops[3].imm == 12;
+        } else if (n != 3) {
+            return fail(a, "unexpected operand");
+        }
+
+        // Like GNU as: a negative immediate flips add and sub.
+        if (imm < 0) {
+            imm = -imm;
+            head ^= 1u << 30;
+        }
+        if (n == 3 && imm > 0xFFF && (imm & 0xFFF) == 0) {
+            imm >>= 12;
+            sh = 1;
+        }
+        if (imm < 0 || imm > 0xFFF)
+            return fail(a, "immediate out of range");
+        *word = head | 0x11000000 | (sh << 22) | ((uint32_t) imm << 10) |
+                (ops[1].reg << 5) | ops[0].reg;
+        return ASM_OK;
+    }
+
+    if (!is_reg(&ops[1]) || !is_gpr(&ops[2], sf) || ops[0].wide != sf || ops[1].wide != sf)
+        return fail(a, "expected registers of the same width");
+
+    // sp operands need the extended-register form (uxtx/uxtw).
+    if (ops[0].sp || ops[1].sp) {
+        if (ops[1].zr || (ops[0].zr && !flags) || (ops[0].sp && flags) || (n == 4 && (ops[3].kind != OP_SHIFT ||
+                ops[3].shift != SHIFT_LSL || ops[3].imm < 0 || ops[3].imm > 4)) || n > 4)
+            return fail(a, "bad operands for an add/sub with sp");
+        amount = n == 4 ? ops[3].imm : 0;
+        *word = head | 0x0B200000 | (ops[2].reg << 16) | ((sf ? 3u : 2u) << 13) |
+                (amount << 10) | (ops[1].reg << 5) | ops[0].reg;
+        return ASM_OK;
+    }
+
+    if (optional_shift(a, ops, n, 3, width, 0, &type, &amount) != ASM_OK)
+        return ASM_ERR_SYNTAX;
+    *word = head | 0x0B000000 | (type << 22) | (ops[2].reg << 16) | (amount << 10) |
+            (ops[1].reg << 5) | ops[0].reg;
+    return ASM_OK;
+}
+
+/**
+ * @brief and, orr, eor, ands, bic, orn, eon, bics, tst, mvn.
+ */
+static int enc_logic(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    uint32_t opc = m->arg & 3;
+    int type, amount;
+
+    n = implicit_zr(ops, n, m->arg);
+    if (n < 3 || !is_reg(&ops[0]))
+        return fail(a, "expected registers");
+    int sf = ops[0].wide, width = sf ? 64 : 32;
+    uint32_t head = ((uint32_t) sf << 31) | (opc << 29);
+
+    if (ops[2].kind == OP_IMM) {
+        uint32_t bits;
+        if (n != 3 || (m->arg & ARG_INVERT))
+            return fail(a, "unexpected immediate");
+        if ((opc == 3 ? !is_gpr(&ops[0], sf) : !is_gpr_sp(&ops[0], sf)) ||
+                !is_gpr(&ops[1], sf))
+            return fail(a, "bad register for a logical immediate");
+        if (!encode_bitmask(ops[2].imm, width, &bits))
+            return fail(a, "immediate is not a valid bitmask");
+        *word = head | 0x12000000 | bits | (ops[1].reg << 5) | ops[0].reg;
+        return ASM_OK;
+    }
+
+    if (!is_gpr(&ops[0], sf) || !is_gpr(&ops[1], sf) || !is_gpr(&ops[2], sf))
+        return fail(a, "expected registers of the same width");
+    if (optional_shift(a, ops, n, 3, width, 1, &type, &amount) != ASM_OK)
+        return ASM_ERR_SYNTAX;
+    *word = head | 0x0A000000 | (type << 22) | (((m->arg & ARG_INVERT) != 0) << 21) |
+            (ops[2].reg << 16) | (amount << 10) | (ops[1].reg << 5) | ops[0].reg;
+    return ASM_OK;
+}
+
+/**
+ * @brief Picks the single instruction GNU as uses for "mov Rd, #imm":
+ *        movz, then movn, then orr with a bitmask immediate.
+ */
+static int mov_immediate(Asm *a, const Operand *rd, int64_t imm, uint32_t *word) {
+    int sf = rd->wide, width = sf ? 64 : 32, hw;
+    uint64_t v = imm;
+    uint32_t bits;
+
+    if (!sf) {
+        if (imm < -(1ll << 31) || imm > 0xFFFFFFFFll)
+            return fail(a, "immediate out of range");
+        v &= 0xFFFFFFFFull;
+    }
+
+    if (!rd->sp) {
+        for (int inverted = 0; inverted < 2; inverted++) {
+            uint64_t x = inverted ? (~v & (sf ? ~0ull : 0xFFFFFFFFull)) : v;
+            for (hw = 0; hw < width / 16; hw++) {
+                if ((x & ~(0xFFFFull << (16 * hw))) != 0)
+                    continue;
+                *word = ((uint32_t) sf << 31) | (inverted ? 0x12800000 : 0x52800000) |
+                        (hw << 21) | ((uint32_t) ((x >> (16 * hw)) & 0xFFFF) << 5) | rd->reg;
+                return ASM_OK;
+            }
+        }
+    }
+
+    if (encode_bitmask(v, width, &bits)) {
+        *word = ((uint32_t) sf << 31) | 0x32000000 | bits | (31 << 5) | rd->reg;
+        return ASM_OK;
+    }
+    return fail(a, "immediate cannot be loaded with a single mov");
+}
+
+/**
+ * @brief mov between registers or of an immediate.
+ */
+static int enc_mov(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    (void) m;
+    if (n != 2 || !is_reg(&ops[0]))
+        return fail(a, "expected a register and a source");
+    int sf = ops[0].wide;
+
+    if (ops[1].kind == OP_IMM)
+        return mov_immediate(a, &ops[0], ops[1].imm, word);
+    if (!is_reg(&ops[1]) || ops[1].wide != sf)
+        return fail(a, "expected registers of the same width");
+
+    if (ops[0].sp || ops[1].sp) {
+        if (ops[0].zr || ops[1].zr)
+            return fail(a, "cannot mov between sp and zr");
+        *word = ((uint32_t) sf << 31) | 0x11000000 | (ops[1].reg << 5) | ops[0].reg;
+    } else {
+        *word = ((uint32_t) sf << 31) | 0x2A0003E0 | (ops[1].reg << 16) | ops[0].reg;
+    }
+    return ASM_OK;
+}
+
+/**
+ * @brief movn, movz, movk. arg is the opc field.
+ */
+static int enc_movw(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (n < 2 || !is_gpr(&ops[0], ops[0].wide) || ops[1].kind != OP_IMM)
+        return fail(a, "expected a register and an immediate");
+    int sf = ops[0].wide, width = sf ? 64 : 32, hw = 0;
+    int64_t imm = ops[1].imm;
+
+    if (n == 3) {
+        if (ops[2].kind != OP_SHIFT || ops[2].shift != SHIFT_LSL ||
+                ops[2].imm % 16 != 0 || ops[2].imm < 0 || ops[2].imm >= width)
+            return fail(a, "shift must be lsl by a multiple of 16");
+        hw = ops[2].imm / 16;
+    } else if (n != 2) {
+        return fail(a, "unexpected operand");
+    }
+    if (imm < 0 || imm > 0xFFFF)
+        return fail(a, "immediate out of range");
+
+    *word = ((uint32_t) sf << 31) | (m->arg << 29) | 0x12800000 | (hw << 21) |
+            ((uint32_t) imm << 5) | ops[0].reg;
+    return ASM_OK;
+}
+
+/**
+ * @brief lsl, lsr, asr, ror by an immediate (bitfield aliases) or a register.
+ */
+static int enc_shift(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (n != 3 || !is_gpr(&ops[0], ops[0].wide) || !is_gpr(&ops[1], ops[0].wide))
+        return fail(a, "expected registers of the same width");
+    uint32_t sf = ops[0].wide, width = sf ? 64 : 32;
+    uint32_t rd = ops[0].reg, rn = ops[1].reg;
+
+    if (ops[2].kind != OP_IMM) {
+        if (!is_gpr(&ops[2], sf))
+            return fail(a, "expected a shift amount");
+        *word = (sf << 31) | 0x1AC02000 | (ops[2].reg << 16) | (m->arg << 10) | (rn << 5) | rd;
+        return ASM_OK;
+    }
+
+    if (ops[2].imm < 0 || ops[2].imm >= width)
+        return fail(a, "shift amount out of range");
+    uint32_t s = ops[2].imm;
+    uint32_t ubfm = sf ? 0xD3400000 : 0x53000000, sbfm = sf ? 0x93400000 : 0x13000000;
+
+    switch (m->arg) {
+    case SHIFT_LSL:
+        *word = ubfm | (((width - s) % width) << 16) | ((width - 1 - s) << 10);
+        break;
+    case SHIFT_LSR:
+        *word = ubfm | (s << 16) | ((width - 1) << 10);
+        break;
+    case SHIFT_ASR:
+        *word = sbfm | (s << 16) | ((width - 1) << 10);
+        break;
+    default:
+        // extr Rd, Rn, Rn, #s
+        *word = (sf ? 0x93C00000 : 0x13800000) | (rn << 16) | (s << 10);
+        break;
+    }
+    *word |= (rn << 5) | rd;
+    return ASM_OK;
+}
+
+#define MUL_ACC    0x1   ///< madd/msub: explicit accumulator
+#define MUL_SUB    0x2   ///< msub/mneg
+#define MUL_DIV    0x4   ///< udiv/sdiv (MUL_SUB selects sdiv)
+
+/**
+ * @brief mul, mneg, madd, msub, udiv, sdiv.
+ */
+static int enc_mul(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    int k, want = (m->arg & MUL_ACC) ? 4 : 3;
+
+    if (n != want)
+        return fail(a, "wrong number of operands");
+    for (k = 0; k < n; k++) {
+        if (!is_gpr(&ops[k], ops[0].wide))
+            return fail(a, "expected registers of the same width");
+    }
+    uint32_t sf = ops[0].wide;
+    uint32_t ra = n == 4 ? ops[3].reg : 31;
+    uint32_t regs = (ops[2].reg << 16) | (ops[1].reg << 5) | ops[0].reg;
+
+    if (m->arg & MUL_DIV)
+        *word = (sf << 31) | 0x1AC00800 | (((m->arg & MUL_SUB) != 0) << 10) | regs;
+    else
+        *word = (sf << 31) | 0x1B000000 | (((m->arg & MUL_SUB) != 0) << 15) | (ra << 10) | regs;
+    return ASM_OK;
+}
+
+/**
+ * @brief b, bl (arg is the opcode).
+ */
+static int enc_branch(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (n != 1 || ops[0].kind != OP_LABEL)
+        return fail(a, "expected a label");
+    fixup_add(a, FIX_IMM26, ops[0].label);
+    *word = m->arg;
+    return ASM_OK;
+}
+
+/**
+ * @brief b.cond and its bcond spellings (arg is the condition).
+ */
+static int enc_bcond(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (n != 1 || ops[0].kind != OP_LABEL)
+        return fail(a, "expected a label");
+    fixup_add(a, FIX_IMM19, ops[0].label);
+    *word = 0x54000000 | m->arg;
+    return ASM_OK;
+}
+
+/**
+ * @brief cbz, cbnz (arg is the op bit).
+ */
+static int enc_cb(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (n != 2 || !is_gpr(&ops[0], ops[0].wide) || ops[1].kind != OP_LABEL)
+        return fail(a, "expected a register and a label");
+    fixup_add(a, FIX_IMM19, ops[1].label);
+    *word = ((uint32_t) ops[0].wide << 31) | 0x34000000 | (m->arg << 24) | ops[0].reg;
+    return ASM_OK;
+}
+
+/**
+ * @brief br, blr, ret (arg is the opcode; ret defaults to x30).
+ */
+static int enc_branch_reg(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    uint32_t rn = 30;
+
+    if (n > 1 || (n == 0 && m->arg != 0xD65F0000) || (n == 1 && !is_gpr(&ops[0], 1)))
+        return fail(a, "expected an x register");
+    if (n == 1)
+        rn = ops[0].reg;
+    *word = m->arg | (rn << 5);
+    return ASM_OK;
+}
+
+#define LS_LOAD    0x04   ///< Load rather than store
+#define LS_SCALED  0x08   ///< ldr/str: prefer the scaled unsigned offset form
+#define LS_BY_RT   0x10   ///< Access size follows the width of Rt (size bits unused)
+
+/**
+ * @brief ldur/stur and ldr/str with their b/h variants. The low two bits of
+ *        arg are log2 of the access size.
+ */
+static int enc_ldst(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    uint32_t size = m->arg & 3, load = (m->arg & LS_LOAD) != 0;
+
+    if (n != 2 || !is_reg(&ops[0]) || ops[0].sp)
+        return fail(a, "expected a register and an address");
+    if (m->arg & LS_BY_RT)
+        size = ops[0].wide ? 3 : 2;
+    else if (ops[0].wide)
+        return fail(a, "byte and halfword accesses use a w register");
+
+    // ldr Rt, label: pc-relative literal.
+    if (ops[1].kind == OP_LABEL && load && (m->arg & LS_BY_RT) && (m->arg & LS_SCALED)) {
+        fixup_add(a, FIX_IMM19, ops[1].label);
+        *word = (ops[0].wide ? 0x58000000 : 0x18000000) | ops[0].reg;
+        return ASM_OK;
+    }
+    if (ops[1].kind != OP_MEM)
+        return fail(a, "expected [Xn, #offset]");
+
+    int64_t off = ops[1].imm;
+    uint32_t regs = (ops[1].reg << 5) | ops[0].reg;
+    if ((m->arg & LS_SCALED) && off >= 0 && (off & ((1 << size) - 1)) == 0 &&
+            (off >> size) <= 0xFFF) {
+        *word = (size << 30) | 0x39000000 | (load << 22) | ((uint32_t) (off >> size) << 10) | regs;
+        return ASM_OK;
+    }
+    if (off < -256 || off > 255)
+        return fail(a, "offset out of range");
+    *word = (size << 30) | 0x38000000 | (load << 22) | ((uint32_t) (off & 0x1FF) << 12) | regs;
+    return ASM_OK;
+}
+
+/**
+ * @brief hlt, brk, svc (arg is the opcode), nop (no operands).
+ */
+static int enc_system(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    if (m->arg == NOP_WORD) {
+        if (n != 0)
+            return fail(a, "unexpected operand");
+        *word = NOP_WORD;
+        return ASM_OK;
+    }
+    if (n != 1 || ops[0].kind != OP_IMM || ops[0].imm < 0 || ops[0].imm > 0xFFFF)
+        return fail(a, "expected a 16-bit immediate");
+    *word = m->arg | ((uint32_t) ops[0].imm << 5);
+    return ASM_OK;
+}
+
+/**
+ * @brief mrs Xt, sysreg, for the counters the simulator provides.
+ */
+static int enc_mrs(Asm *a, const Mnemonic *m, Operand *ops, int n, uint32_t *word) {
+    static const struct { const char *name; uint32_t word; } sysregs[] = {
+        { "pmccntr_el0", 0xD53B9D00 },
+        { "cntvct_el0",  0xD53BE040 },
+    };
+    (void) m;
+
+    if (n != 2 || !is_gpr(&ops[0], 1) || ops[1].kind != OP_LABEL)
+        return fail(a, "expected an x register and a system register");
+    for (size_t k = 0; k < sizeof(sysregs) / sizeof(sysregs[0]); k++) {
+        if (strcasecmp(a->labels[ops[1].label].name, sysregs[k].name) == 0) {
+            *word = sysregs[k].word | ops[0].reg;
+            return ASM_OK;
+        }
+    }
+    return fail(a, "unknown system register");
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * MNEMONIC TABLE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static const Mnemonic mnemonics[] = {
+    { "add",   enc_addsub, 0 },
+    { "adds",  enc_addsub, ARG_FLAGS },
+    { "sub",   enc_addsub, ARG_SUB },
+    { "subs",  enc_addsub, ARG_SUB | ARG_FLAGS },
+    { "cmp",   enc_addsub, ARG_SUB | ARG_FLAGS | ARG_NO_RD },
+    { "cmn",   enc_addsub, ARG_FLAGS | ARG_NO_RD },
+    { "neg",   enc_addsub, ARG_SUB | ARG_NO_RN },
+    { "negs",  enc_addsub, ARG_SUB | ARG_FLAGS | ARG_NO_RN },
+    { "and",   enc_logic,  0 },
+    { "orr",   enc_logic,  1 },
+    { "eor",   enc_logic,  2 },
+    { "ands",  enc_logic,  3 },
+    { "bic",   enc_logic,  0 | ARG_INVERT },
+    { "orn",   enc_logic,  1 | ARG_INVERT },
+    { "eon",   enc_logic,  2 | ARG_INVERT },
+    { "bics",  enc_logic,  3 | ARG_INVERT },
+    { "tst",   enc_logic,  3 | ARG_NO_RD },
+    { "mvn",   enc_logic,  1 | ARG_INVERT | ARG_NO_RN },
+    { "mov",   enc_mov,    0 },
+    { "movn",  enc_movw,   0 },
+    { "movz",  enc_movw,   2 },
+    { "movk",  enc_movw,   3 },
+    { "lsl",   enc_shift,  SHIFT_LSL },
+    { "lsr",   enc_shift,  SHIFT_LSR },
+    { "asr",   enc_shift,  SHIFT_ASR },
+    { "ror",   enc_shift,  SHIFT_ROR },
+    { "mul",   enc_mul,    0 },
+    { "mneg",  enc_mul,    MUL_SUB },
+    { "madd",  enc_mul,    MUL_ACC },
+    { "msub",  enc_mul,    MUL_ACC | MUL_SUB },
+    { "udiv",  enc_mul,    MUL_DIV },
+    { "sdiv",  enc_mul,    MUL_DIV | MUL_SUB },
+    { "b",     enc_branch, 0x14000000 },
+    { "bl",    enc_branch, 0x94000000 },
+    { "cbz",   enc_cb,     0 },
+    { "cbnz",  enc_cb,     1 },
+    { "br",    enc_branch_reg, 0xD61F0000 },
+    { "blr",   enc_branch_reg, 0xD63F0000 },
+    { "ret",   enc_branch_reg, 0xD65F0000 },
+    { "ldur",  enc_ldst,   LS_LOAD | LS_BY_RT },
+    { "stur",  enc_ldst,   LS_BY_RT },
+    { "ldurb", enc_ldst,   LS_LOAD },
+    { "sturb", enc_ldst,   0 },
+    { "ldurh", enc_ldst,   LS_LOAD | 1 },
+    { "sturh", enc_ldst,   1 },
+    { "ldr",   enc_ldst,   LS_LOAD | LS_SCALED | LS_BY_RT },
+    { "str",   enc_ldst,   LS_SCALED | LS_BY_RT },
+    { "ldrb",  enc_ldst,   LS_LOAD | LS_SCALED },
+    { "strb",  enc_ldst,   LS_SCALED },
+    { "ldrh",  enc_ldst,   LS_LOAD | LS_SCALED | 1 },
+    { "strh",  enc_ldst,   LS_SCALED | 1 },
+    { "hlt",   enc_system, 0xD4400000 },
+    { "brk",   enc_system, 0xD4200000 },
+    { "svc",   enc_system, 0xD4000001 },
+    { "nop",   enc_system, NOP_WORD },
+    { "mrs",   enc_mrs,    0 },
+};
+
+static const char *conditions[16] = {
+    "eq", "ne", "cs", "cc", "mi", "pl", "vs", "vc",
+    "hi", "ls", "ge", "lt", "gt", "le", "al", "nv",
+};
+
+/**
+ * @brief Condition code for a suffix, accepting hs/lo for cs/cc; -1 if none.
+ */
+static int condition(const char *s) {
+    int k;
+    if (strcmp(s, "hs") == 0) return 2;
+    if (strcmp(s, "lo") == 0) return 3;
+    for (k = 0; k < 16; k++) {
+        if (strcmp(s, conditions[k]) == 0)
+            return k;
+    }
+    return -1;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * STATEMENTS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Appends one little-endian word to the output.
+ */
+static int emit(Asm *a, uint32_t word) {
+    if (a->size + 4 > a->room)
+        return ASM_ERR_TOO_BIG;
+    if (a->size / 4 == a->lines_cap) {
+        a->lines_cap = a->lines_cap ? 2 * a->lines_cap : 256;
+        a->lines = realloc(a->lines, a->lines_cap * sizeof(int));
+    }
+    a->lines[a->size / 4] = a->line;
+    a->out[a->size + 0] = word;
+    a->out[a->size + 1] = word >> 8;
+    a->out[a->size + 2] = word >> 16;
+    a->out[a->size + 3] = word >> 24;
+    a->size += 4;
+    return ASM_OK;
+}
+
+/**
+ * @brief Parses the comma-separated operand list of a statement.
+ *
+ * @return int Number of operands, or -1 on error.
+ */
+static int parse_operands(Asm *a, const char *p, Operand *ops) {
+    int n = 0;
+
+    p = skip_space(p);
+    while (*p) {
+        if (n == MAX_OPERANDS)
+            return fail(a, "too many operands"), -1;
+        if ((p = parse_operand(a, p, &ops[n++])) == NULL)
+            return -1;
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return fail(a, "junk after operand"), -1;
+    }
+    return n;
+}
+
+/**
+ * @brief Handles an assembler directive.
+ */
+static int directive(Asm *a, const char *name, const char *rest) {
+    Operand ops[MAX_OPERANDS];
+    int n, k, rc;
+
+    if (strcmp(name, ".text") == 0 || strcmp(name, ".global") == 0 ||
+            strcmp(name, ".globl") == 0 || strcmp(name, ".type") == 0 ||
+            strcmp(name, ".size") == 0 || strcmp(name, ".file") == 0 ||
+            strcmp(name, ".ident") == 0)
+        return ASM_OK;
+    if (strcmp(name, ".section") == 0) {
+        rest = skip_space(rest);
+        if (strncmp(rest, ".text", 5) != 0 || is_ident(rest[5]))
+            return fail(a, "only the .text section is supported");
+        return ASM_OK;
+    }
+
+    if (strcmp(name, ".word") == 0 || strcmp(name, ".4byte") == 0 ||
+            strcmp(name, ".long") == 0 || strcmp(name, ".inst") == 0) {
+        if ((n = parse_operands(a, rest, ops)) < 0)
+            return ASM_ERR_SYNTAX;
+        for (k = 0; k < n; k++) {
+            uint32_t word = 0;
+            if (ops[k].kind == OP_LABEL)
+                fixup_add(a, FIX_ABS32, ops[k].label);
+            else if (ops[k].kind == OP_IMM && ops[k].imm >= -(1ll << 31) &&
+                     ops[k].imm <= 0xFFFFFFFFll)
+                word = ops[k].imm;
+            else
+                return fail(a, "expected a 32-bit value");
+            if ((rc = emit(a, word)) != ASM_OK)
+                return rc;
+        }
+        return ASM_OK;
+    }
+
+    if (strcmp(name, ".align") == 0 || strcmp(name, ".p2align") == 0 ||
+            strcmp(name, ".balign") == 0) {
+        if ((n = parse_operands(a, rest, ops)) != 1 || ops[0].kind != OP_IMM ||
+                ops[0].imm < 0 || ops[0].imm > (name[1] == 'b' ? 1 << 16 : 16))
+            return fail(a, "bad alignment");
+        uint64_t align = name[1] == 'b' ? (uint64_t) ops[0].imm : 1ull << ops[0].imm;
+        if (align & (align - 1))
+            return fail(a, "alignment must be a power of two");
+        // Code is padded with nops, as GNU as does in text sections.
+        while (align > 4 && (a->size & (align - 1))) {
+            if ((rc = emit(a, NOP_WORD)) != ASM_OK)
+                return rc;
+        }
+        return ASM_OK;
+    }
+
+    return fail(a, "unsupported directive");
+}
+
+/**
+ * @brief Assembles one statement: optional labels, then an instruction or
+ *        a directive.
+ */
+static int statement(Asm *a, const char *p) {
+    Operand ops[MAX_OPERANDS];
+    char name[16];
+    int n, k, len;
+
+    while (1) {
+        p = skip_space(p);
+        const char *s = p;
+        while (is_ident(*p))
+            p++;
+        len = p - s;
+        if (len == 0)
+            return *p ? fail(a, "expected a mnemonic") : ASM_OK;
+
+        if (*p == ':') {
+            if (isdigit((unsigned char) *s))
+                return fail(a, "numeric labels are not supported");
+            k = label_find(a, s, len);
+            if (a->labels[k].addr != UNDEFINED)
+                return fail(a, "label defined twice");
+            a->labels[k].addr = a->base + a->size;
+            p++;
+            continue;
+        }
+
+        if (len >= (int) sizeof(name))
+            return fail(a, "unknown mnemonic");
+        for (k = 0; k < len; k++)
+            name[k] = tolower((unsigned char) s[k]);
+        name[len] = '\0';
+        break;
+    }
+
+    if (name[0] == '.')
+        return directive(a, name, p);
+
+    const Mnemonic *m = NULL;
+    Mnemonic cond = { name, enc_bcond, 0 };
+    for (k = 0; k < (int) (sizeof(mnemonics) / sizeof(mnemonics[0])); k++) {
+        if (strcmp(name, mnemonics[k].name) == 0) {
+            m = &mnemonics[k];
+            break;
+        }
+    }
+    if (m == NULL && name[0] == 'b') {
+        // GNU as spells b.al and b.nv only with the dot.
+        int c = condition(name + (name[1] == '.' ? 2 : 1));
+        if (c >= 0 && (name[1] == '.' || c < 14)) {
+            cond.arg = c;
+            m = &cond;
+        }
+    }
+    if (m == NULL)
+        return fail(a, "unknown mnemonic");
+
+    if (*p && *p != ' ' && *p != '\t')
+        return fail(a, "unknown mnemonic");
+    if ((n = parse_operands(a, p, ops)) < 0)
+        return ASM_ERR_SYNTAX;
+
+    uint32_t word;
+    if (m->encode(a, m, ops, n, &word) != ASM_OK)
+        return ASM_ERR_SYNTAX;
+    return emit(a, word);
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * PUBLIC INTERFACE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Assembles a source buffer into machine code at out.
+ */
+int asm_assemble(const char *text, uint64_t len, uint64_t base,
+                 uint8_t *out, uint64_t room, AsmResult *result) {
+    Asm a;
+    const char *p = text, *end = text + len;
+    char buf[ASM_MAX_LINE];
+    int rc = ASM_OK, line_start = 1;
+
+    memset(&a, 0, sizeof(a));
+    a.base = base;
+    a.out = out;
+    a.room = room;
+    a.line = 1;
+
+    while (rc == ASM_OK && p < end) {
+        int n = 0, line = a.line;
+
+        // '#' in the first column starts a comment line (cpp line markers).
+        const char *q = p;
+        while (line_start && q < end && (*q == ' ' || *q == '\t'))
+            q++;
+        if (line_start && q < end && *q == '#') {
+            while (p < end && *p != '\n')
+                p++;
+        }
+
+        // Gather one statement, up to a newline or ';', dropping comments.
+        while (p < end && *p != '\n' && *p != ';') {
+            char c = *p++;
+            if (c == '/' && p < end && *p == '/') {
+                while (p < end && *p != '\n')
+                    p++;
+                break;
+            }
+            if (c == '/' && p < end && *p == '*') {
+                for (p++; p < end && !(*p == '*' && p + 1 < end && p[1] == '/'); p++) {
+                    if (*p == '\n')
+                        a.line++;
+                }
+                p = p + 2 < end ? p + 2 : end;
+                c = ' ';
+            }
+            if (n < ASM_MAX_LINE - 1)
+                buf[n] = c;
+            n++;
+        }
+        line_start = p == end || *p == '\n';
+        if (p < end) {
+            if (*p == '\n')
+                a.line++;
+            p++;
+        }
+
+        buf[n < ASM_MAX_LINE ? n : ASM_MAX_LINE - 1] = '\0';
+        int saved = a.line;
+        a.line = line;
+        if (n >= ASM_MAX_LINE)
+            rc = fail(&a, "statement too long");
+        else
+            rc = statement(&a, buf);
+        if (rc == ASM_OK)
+            a.line = saved;
+    }
+
+    if (rc == ASM_OK)
+        rc = fixups_resolve(&a);
+
+    if (rc == ASM_ERR_TOO_BIG && a.error == NULL)
+        a.error = "program too big";
+    result->size = a.size;
+    result->line = a.line;
+    result->error = a.error;
+    result->labels = a.labels;
+    result->nlabels = a.nlabels;
+    result->lines = a.lines;
+
+    free(a.table);
+    free(a.fixups);
+    return rc;
+}
+
+/**
+ * @brief Frees the labels and line table held by a result.
+ */
+void asm_release(AsmResult *result) {
+    int i;
+
+    for (i = 0; i < result->nlabels; i++)
+        free(result->labels[i].name);
+    free(result->labels);
+    free(result->lines);
+    result->labels = NULL;
+    result->nlabels = 0;
+    result->lines = NULL;
+}
+
+// final version
@@ -0,0 +1,78 @@
+/**
+ * @file asm.h
+ * @brief Built-in assembler for the AArch64 subset the simulator runs.
+ */
+
+#ifndef ASM_H
+#define ASM_H
+
+#include <stdint.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * RESULT CODES
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define ASM_OK           0
+#define ASM_ERR_SYNTAX  -1   ///< Statement not understood; line and error are set
+#define ASM_ERR_TOO_BIG -2   ///< Code does not fit in the output buffer
+
+#define ASM_MAX_LINE 256     ///< Longest statement accepted
+
+/**
+ * @struct AsmLabel
+ * @brief A label defined by the source and the address it was given.
+ */
+typedef struct {
+    char *name;
+    uint64_t addr;
+} AsmLabel;
+
+/**
+ * @struct AsmResult
+ * @brief Outcome of assembling one source buffer.
+ */
+typedef struct {
+    uint64_t size;        ///< Bytes of code emitted
+    int line;             ///< Line of the first error
+    const char *error;    ///< What was wrong on that line
+    AsmLabel *labels;     ///< Defined labels (release with asm_release)
+    int nlabels;
+    int *lines;           ///< Source line of each emitted word (release with asm_release)
+} AsmResult;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FUNCTION DECLARATIONS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Assembles GNU-syntax AArch64 source into machine code.
+ *
+ * Encodings match GNU as for the supported subset: add/sub/adds/subs,
+ * cmp/cmn/neg, the logical operations (register and bitmask immediate),
+ * mov/movz/movn/movk, the shifts, mul/madd/msub/udiv/sdiv, b/bl/b.cond,
+ * cbz/cbnz, br/blr/ret, ldur/stur and ldr/str in their byte, halfword,
+ * word and doubleword forms, hlt/brk/svc/nop, labels, and the .word,
+ * .inst, .align and .balign directives.
+ *
+ * Forward references are patched once the whole buffer has been read, so
+ * the source is scanned a single time.
+ *
+ * @param text   Source text (need not be NUL-terminated).
+ * @param len    Source length in bytes.
+ * @param base   Guest address of the first emitted word.
+ * @param out    Receives the little-endian code.
+ * @param room   Bytes available at out.
+ * @param result Receives the size, labels and, on error, line and message.
+ * @return int ASM_OK or one of the ASM_ERR_* codes.
+ */
+int asm_assemble(const char *text, uint64_t len, uint64_t base,
+                 uint8_t *out, uint64_t room, AsmResult *result);
+
+/**
+ * @brief Frees the labels and line table held by a result.
+ */
+void asm_release(AsmResult *result);
+
+#endif // ASM_H
+
+// final version
@@ -0,0 +1,84 @@
+/**
+ * @file console.c
+ * @brief Memory-mapped console device with a batched host output buffer.
+ */
+
+#include "console.h"
+#include "memory.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * DEVICE STATE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static char buffer[CONSOLE_BUFFER_SIZE];
+static uint32_t used;
+static int out_fd = STDOUT_FILENO;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REGISTER CALLBACKS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Register writes: TX appends a byte, FLUSH drains the buffer.
+ */
+static void console_write(void *ctx, uint64_t offset, uint32_t value) {
+    (void) ctx;
+
+    if (offset == CONSOLE_TX) {
+        buffer[used++] = value & 0xFF;
+        if (used == CONSOLE_BUFFER_SIZE)
+            console_flush();
+    } else if (offset == CONSOLE_FLUSH) {
+        console_flush();
+    }
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * PUBLIC INTERFACE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Registers the console device and opens its output.
+ */
+int console_init(const char *path) {
+    // Reads return 0, which keeps STURB's read-modify-write working.
+    if (mem_register_device(CONSOLE_BASE, CONSOLE_SIZE, NULL, console_write, NULL) < 0)
+        return -2;
+
+    if (path != NULL) {
+        out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (out_fd < 0)
+            return -1;
+    }
+
+    atexit(console_flush);
+    return 0;
+}
+
+/**
+ * @brief Writes out everything buffered so far with a single write().
+ */
+void console_flush() {
+    uint32_t done = 0;
+
+    if (used == 0)
+        return;
+
+    // Keep guest output ordered with the shell's own stdio output.
+    if (out_fd == STDOUT_FILENO)
+        fflush(stdout);
+
+    while (done < used) {
+        ssize_t n = write(out_fd, buffer + done, used - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    used = 0;
+}
+
+// final version
@@ -0,0 +1,39 @@
+/**
+ * @file console.h
+ * @brief Memory-mapped console device with a batched host output buffer.
+ *
+ * Register map (offsets from CONSOLE_BASE, 32-bit accesses):
+ *   0x00  TX     write: append the low byte to the output buffer
+ *   0x04  -      ignored (lets a 64-bit STUR to TX emit one byte)
+ *   0x08  FLUSH  write: hand the buffer to the host now
+ */
+
+#ifndef CONSOLE_H
+#define CONSOLE_H
+
+#include <stdint.h>
+
+#define CONSOLE_BASE   0x20000000
+#define CONSOLE_SIZE   0x10
+#define CONSOLE_TX     0x0
+#define CONSOLE_FLUSH  0x8
+
+#define CONSOLE_BUFFER_SIZE (1 << 16)  ///< Bytes batched per host write()
+
+/**
+ * @brief Registers the console device and opens its output.
+ *
+ * @param path Output file, or NULL for stdout.
+ * @return int 0 on success, -1 if the file can't be opened, -2 if the
+ *         device window overlaps a mapped region.
+ */
+int console_init(const char *path);
+
+/**
+ * @brief Writes out everything buffered so far with a single write().
+ */
+void console_flush();
+
+#endif // CONSOLE_H
+
+// final version
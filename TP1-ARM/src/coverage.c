@@ -0,0 +1,280 @@
+/**
+ * @file coverage.c
+ * @brief Guest code coverage: a bitmap per run, merged into lcov tracefiles.
+ */
+
+#include "coverage.h"
+#include "shell.h"
+#include "memory.h"
+#include "decoder.h"
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define COV_THREADS 64   ///< Most merge threads started
+
+/**
+ * @struct MergeJob
+ * @brief One merge thread's share of the inputs and its private counts.
+ */
+typedef struct {
+    char **inputs;
+    int first, step, n;
+    uint64_t words;
+    uint32_t *counts;     ///< words entries for each of the three flags
+    int merged;
+} MergeJob;
+
+/**
+ * @struct Line
+ * @brief One instruction as it appears in the tracefile.
+ */
+typedef struct {
+    const char *path;
+    int line;
+    uint64_t word;
+} Line;
+
+int covering;
+
+static uint8_t *map;
+static uint64_t base, size;
+static char *map_path;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * RECORDING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Writes the map up to its last touched word.
+ */
+static void coverage_write() {
+    CovHeader header;
+    uint64_t words = size / 4;
+    FILE *out;
+
+    while (words > 0 && map[words - 1] == 0)
+        words--;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, COV_MAGIC, sizeof(header.magic));
+    header.base = base;
+    header.words = words;
+
+    if ((out = fopen(map_path, "wb")) == NULL) {
+        fprintf(stderr, "Can't write coverage to %s\n", map_path);
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, out);
+    fwrite(map, 1, words, out);
+    fclose(out);
+}
+
+int coverage_start(const char *path) {
+    if (map == NULL) {
+        base = mem_text_region()->start;
+        size = mem_text_region()->size & ~3ull;
+        if ((map = calloc(size / 4, 1)) == NULL)
+            return -1;
+        atexit(coverage_write);
+    }
+    free(map_path);
+    map_path = strdup(path);
+    covering = 1;
+    return 0;
+}
+
+void coverage_retire(uint64_t pc, uint64_t next) {
+    uint64_t off = pc - base;
+
+    // COV_FALLTHROUGH shifted once is COV_TAKEN, so no branch on the edge.
+    if (off < size)
+        map[off >> 2] |= COV_EXEC | COV_FALLTHROUGH << (next != pc + 4);
+}
+
+void coverage_reset() {
+    if (map != NULL)
+        memset(map, 0, size / 4);
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * MERGING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void *merge_worker(void *arg) {
+    MergeJob *job = arg;
+    uint8_t *flags = malloc(job->words);
+    uint32_t *exec = job->counts, *fall = exec + job->words, *taken = fall + job->words;
+    int i;
+
+    for (i = job->first; flags != NULL && i < job->n; i += job->step) {
+        CovHeader header;
+        uint64_t w, words;
+        FILE *in = fopen(job->inputs[i], "rb");
+
+        if (in == NULL || fread(&header, sizeof(header), 1, in) != 1
+                || memcmp(header.magic, COV_MAGIC, sizeof(header.magic)) != 0
+                || header.base != base) {
+            fprintf(stderr, "Skipping %s: not a coverage map for this program\n", job->inputs[i]);
+            if (in != NULL)
+                fclose(in);
+            continue;
+        }
+        words = header.words < job->words ? header.words : job->words;
+        if (fread(flags, 1, words, in) != words) {
+            fprintf(stderr, "Skipping %s: truncated\n", job->inputs[i]);
+            fclose(in);
+            continue;
+        }
+        fclose(in);
+
+        for (w = 0; w < words; w++) {
+            exec[w] += flags[w] & COV_EXEC;
+            fall[w] += (flags[w] & COV_FALLTHROUGH) >> 1;
+            taken[w] += (flags[w] & COV_TAKEN) >> 2;
+        }
+        job->merged++;
+    }
+    free(flags);
+    return NULL;
+}
+
+static int by_line(const void *a, const void *b) {
+    const Line *x = a, *y = b;
+    int c = strcmp(x->path, y->path);
+
+    if (c == 0)
+        c = x->line - y->line;
+    return c ? c : x->word < y->word ? -1 : x->word > y->word;
+}
+
+static int is_conditional(const Instruction *inst) {
+    return inst->valid && (strcmp(inst->name, "B.cond") == 0 || strcmp(inst->name, "CBZ") == 0
+                           || strcmp(inst->name, "CBNZ") == 0);
+}
+
+/**
+ * @brief Writes one lcov record per source file: functions at labels,
+ *        line hits and, for conditional branches, both edges.
+ */
+static void write_lcov(FILE *out, const uint32_t *counts, uint64_t words) {
+    const uint32_t *exec = counts, *fall = exec + words, *taken = fall + words;
+    Line *lines = malloc(words * sizeof(Line));
+    uint64_t w, n = 0, i, j;
+
+    for (w = 0; lines != NULL && w < words; w++) {
+        const char *path;
+        int line = source_line(base + 4 * w, &path);
+
+        // Words that don't decode are taken to be data in the text.
+        if (line > 0 && decode(mem_read_32(base + 4 * w)).valid)
+            lines[n++] = (Line) { path, line, w };
+    }
+    qsort(lines, n, sizeof(Line), by_line);
+
+    for (i = 0; i < n; i = j) {
+        int lf = 0, lh = 0, fnf = 0, fnh = 0, brf = 0, brh = 0;
+
+        for (j = i; j < n && strcmp(lines[j].path, lines[i].path) == 0; j++)
+            ;
+
+        fprintf(out, "TN:\nSF:%s\n", lines[i].path);
+
+        for (w = i; w < j; w++) {
+            const Symbol *sym = symbol_lookup(base + 4 * lines[w].word);
+            if (sym == NULL || sym->addr != base + 4 * lines[w].word)
+                continue;
+            fprintf(out, "FN:%d,%s\nFNDA:%" PRIu32 ",%s\n", lines[w].line, sym->name,
+                    exec[lines[w].word], sym->name);
+            fnf++;
+            fnh += exec[lines[w].word] > 0;
+        }
+        fprintf(out, "FNF:%d\nFNH:%d\n", fnf, fnh);
+
+        for (w = i; w < j; w++) {
+            uint64_t word = lines[w].word;
+            Instruction inst = decode(mem_read_32(base + 4 * word));
+
+            if (!is_conditional(&inst))
+                continue;
+            if (exec[word] == 0)
+                fprintf(out, "BRDA:%d,%" PRIu64 ",0,-\nBRDA:%d,%" PRIu64 ",1,-\n",
+                        lines[w].line, word, lines[w].line, word);
+            else
+                fprintf(out, "BRDA:%d,%" PRIu64 ",0,%" PRIu32 "\nBRDA:%d,%" PRIu64 ",1,%" PRIu32 "\n",
+                        lines[w].line, word, taken[word], lines[w].line, word, fall[word]);
+            brf += 2;
+            brh += (taken[word] > 0) + (fall[word] > 0);
+        }
+        fprintf(out, "BRF:%d\nBRH:%d\n", brf, brh);
+
+        // Several words on one line (e.g. .align padding) report the most hits.
+        for (w = i; w < j; w++) {
+            uint32_t hits = exec[lines[w].word];
+
+            while (w + 1 < j && lines[w + 1].line == lines[w].line) {
+                w++;
+                if (exec[lines[w].word] > hits)
+                    hits = exec[lines[w].word];
+            }
+            fprintf(out, "DA:%d,%" PRIu32 "\n", lines[w].line, hits);
+            lf++;
+            lh += hits > 0;
+        }
+        fprintf(out, "LF:%d\nLH:%d\nend_of_record\n", lf, lh);
+    }
+    free(lines);
+}
+
+int coverage_merge(const char *out, char **inputs, int n) {
+    MergeJob jobs[COV_THREADS];
+    pthread_t threads[COV_THREADS];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int t, nthreads = cpus < 1 ? 1 : cpus > COV_THREADS ? COV_THREADS : (int) cpus, merged = 0;
+    uint64_t w, words;
+    FILE *f;
+
+    base = mem_text_region()->start;
+    size = mem_text_region()->size & ~3ull;
+    words = size / 4;
+    if (nthreads > n)
+        nthreads = n > 0 ? n : 1;
+
+    for (t = 0; t < nthreads; t++) {
+        jobs[t] = (MergeJob) { inputs, t, nthreads, n, words, calloc(3 * words, sizeof(uint32_t)), 0 };
+        if (jobs[t].counts == NULL || pthread_create(&threads[t], NULL, merge_worker, &jobs[t]) != 0) {
+            free(jobs[t].counts);
+            nthreads = t;
+            break;
+        }
+    }
+    for (t = 0; t < nthreads; t++)
+        pthread_join(threads[t], NULL);
+    if (nthreads == 0) {
+        fprintf(stderr, "Can't start the merge\n");
+        return -1;
+    }
+
+    for (t = 0; t < nthreads; t++) {
+        merged += jobs[t].merged;
+        for (w = 0; t > 0 && w < 3 * words; w++)
+            jobs[0].counts[w] += jobs[t].counts[w];
+        if (t > 0)
+            free(jobs[t].counts);
+    }
+
+    if ((f = fopen(out, "w")) == NULL) {
+        free(jobs[0].counts);
+        return -1;
+    }
+    write_lcov(f, jobs[0].counts, words);
+    fclose(f);
+    free(jobs[0].counts);
+    return merged;
+}
+
+// final version
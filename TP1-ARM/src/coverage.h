@@ -0,0 +1,75 @@
+/**
+ * @file coverage.h
+ * @brief Guest code coverage: a bitmap per run, merged into lcov tracefiles.
+ *
+ * While a run is covered, every retired instruction sets flag bits in one
+ * byte per text word: executed, continued at pc + 4, or went anywhere
+ * else. The byte is written with a single OR whatever the outcome. At exit
+ * the map is written up to its last touched word, after a small header.
+ *
+ * The merge mode reads any number of maps on one thread per host CPU and
+ * counts, for each instruction and branch edge, how many runs covered it.
+ * The result is an lcov tracefile, the format genhtml and the gcov tooling
+ * read, with source lines taken from the loaded program (see
+ * source_line()).
+ */
+
+#ifndef COVERAGE_H
+#define COVERAGE_H
+
+#include <stdint.h>
+
+#define COV_EXEC        1   ///< The instruction retired
+#define COV_FALLTHROUGH 2   ///< It continued at pc + 4
+#define COV_TAKEN       4   ///< It went anywhere else
+
+#define COV_MAGIC "ARMCOV1"  ///< First eight bytes of a map file
+
+/**
+ * @struct CovHeader
+ * @brief Start of a map file; words bytes of flags follow.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t base;    ///< Guest address of the first word
+    uint64_t words;
+} CovHeader;
+
+/**
+ * @brief Enables recording. Checked by cycle() before coverage_retire().
+ */
+extern int covering;
+
+/**
+ * @brief Allocates the map and starts recording; the map is written to
+ *        path when the simulator exits.
+ *
+ * @return int 0 on success, -1 if the map could not be allocated.
+ */
+int coverage_start(const char *path);
+
+/**
+ * @brief Records one retired instruction and the edge it left by.
+ */
+void coverage_retire(uint64_t pc, uint64_t next);
+
+/**
+ * @brief Clears the map.
+ */
+void coverage_reset();
+
+/**
+ * @brief Merges map files into an lcov tracefile for the loaded program.
+ *
+ * @param out    Tracefile to write.
+ * @param inputs Map files.
+ * @param n      Number of map files.
+ * @return int Number of maps merged, or -1 if out can't be written.
+ *         Maps that can't be read or belong to another base are reported
+ *         on stderr and skipped.
+ */
+int coverage_merge(const char *out, char **inputs, int n);
+
+#endif // COVERAGE_H
+
+// final version
@@ -202,6 +202,13 @@ void extract_ldst(Instruction* inst, uint32_t raw) {
     inst->imm = imm9;
 }
 
+/**
+ * @brief Extract fields for MRS (system register read)
+ */
+void extract_mrs(Instruction* inst, uint32_t raw) {
+    inst->Rt = raw & 0x1F;
+}
+
 // ────────────────────────────────────────────────
 // Instruction Pattern Table
 // ────────────────────────────────────────────────
@@ -237,6 +244,9 @@ Pattern patterns[] = {
     ENTRY(0xFFC00000, 0xF8000000, "STUR",     extract_ldst),
     ENTRY(0xFFC00000, 0x38000000, "STURB",    extract_ldst),
     ENTRY(0xFFC00000, 0x78000000, "STURH",    extract_ldst),
+    ENTRY(0xFFE0001F, 0xD4400000, "HLT",      NULL),
+    ENTRY(0xFFFFFFE0, 0xD53B9D00, "MRS",      extract_mrs),  // PMCCNTR_EL0
+    ENTRY(0xFFFFFFE0, 0xD53BE040, "MRS",      extract_mrs),  // CNTVCT_EL0
 };
 
 const int NUM_PATTERNS = sizeof(patterns) / sizeof(Pattern);
@@ -268,4 +278,12 @@ Instruction decode(uint32_t raw) {
     return inst;
 }
 
+/**
+ * @brief Tells whether an instruction ends a basic block.
+ */
+bool inst_ends_block(const Instruction *inst) {
+    return inst->valid && (inst->name[0] == 'B' || strncmp(inst->name, "CB", 2) == 0
+                           || strcmp(inst->name, "HLT") == 0);
+}
+
 // final version
\ No newline at end of file
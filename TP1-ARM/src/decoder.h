@@ -44,6 +44,15 @@ typedef struct {
  */
 Instruction decode(uint32_t raw);
 
+/**
+ * @brief Tells whether an instruction ends a basic block: any branch,
+ *        taken or not, and HLT.
+ *
+ * @param inst Decoded instruction.
+ * @return bool True for B, B.cond, BR, CBZ, CBNZ and HLT.
+ */
+bool inst_ends_block(const Instruction *inst);
+
 #endif // DECODER_H
 
 // final version
\ No newline at end of file
@@ -0,0 +1,301 @@
+/**
+ * @file dump.c
+ * @brief Bulk memory dump formatting.
+ */
+
+#include "dump.h"
+#include "memory.h"
+#include "shell.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define SWAR_ONES  0x0101010101010101ull
+#define LINE_MAX_BYTES 64   ///< Longest formatted line, with room to spare
+
+int dump_symbols;
+
+static char *buffer;
+static size_t used;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FORMATTING HELPERS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Eight lower-case hex digits of a word, most significant first,
+ *        ready to be stored with one 8-byte copy.
+ */
+static uint64_t hex8(uint32_t v) {
+    uint64_t x = v;
+
+    // Spread the nibbles out to one per byte, least significant in byte 0.
+    x = ((x & 0xFFFF0000ull) << 16) | (x & 0xFFFFull);
+    x = ((x & 0x0000FF000000FF00ull) << 8) | (x & 0x000000FF000000FFull);
+    x = ((x & 0x00F000F000F000F0ull) << 4) | (x & 0x000F000F000F000Full);
+
+    // '0' + n, plus 'a' - '9' - 1 more for the nibbles above 9.
+    uint64_t letters = ((x + 0x06 * SWAR_ONES) >> 4) & SWAR_ONES;
+    x += 0x30 * SWAR_ONES + letters * ('a' - '9' - 1);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    x = __builtin_bswap64(x);
+#endif
+    return x;
+}
+
+/**
+ * @brief Appends a word as %x would print it (no leading zeros).
+ */
+static char *put_hex(char *p, uint32_t v) {
+    char digits[8];
+    int n = v ? (32 - __builtin_clz(v) + 3) / 4 : 1;
+    uint64_t x = hex8(v);
+
+    memcpy(digits, &x, 8);
+    memcpy(p, digits + 8 - n, n);
+    return p + n;
+}
+
+/**
+ * @brief Appends an address as %08" PRIx64 " would print it.
+ */
+static char *put_address(char *p, uint64_t address) {
+    uint64_t x;
+
+    if (address >> 32)
+        p = put_hex(p, address >> 32);
+    x = hex8((uint32_t) address);
+    memcpy(p, &x, 8);
+    return p + 8;
+}
+
+/**
+ * @struct Decimal
+ * @brief A decimal number kept as text and advanced in place.
+ */
+typedef struct {
+    char digits[24];
+    int first;        ///< Index of the leading digit; the last is at 22
+} Decimal;
+
+static void decimal_set(Decimal *d, uint64_t v) {
+    d->first = 23;
+    do {
+        d->digits[--d->first] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+}
+
+static void decimal_add4(Decimal *d) {
+    int i = 22, digit = d->digits[i] - '0' + 4;
+
+    while (digit > 9) {
+        d->digits[i--] = '0' + digit - 10;
+        if (i < d->first) {
+            d->first = i;
+            d->digits[i] = '0';
+        }
+        digit = d->digits[i] - '0' + 1;
+    }
+    d->digits[i] = '0' + digit;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * OUTPUT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void flush(FILE *out, FILE *copy) {
+    fwrite(buffer, 1, used, out);
+    if (copy != NULL)
+        fwrite(buffer, 1, used, copy);
+    used = 0;
+}
+
+/**
+ * @brief Host bytes backing address and how many follow it in its region.
+ */
+static const uint8_t *region_at(uint64_t address, uint64_t *room, uint64_t *next) {
+    int i;
+
+    *next = UINT64_MAX;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        const mem_region_t *r = &MEM_REGIONS[i];
+        if (address >= r->start && address - r->start < r->size) {
+            *room = r->size - (address - r->start);
+            return r->mem + (address - r->start);
+        }
+        if (r->start > address && r->start < *next)
+            *next = r->start;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Appends one listing line: address, decimal address and value.
+ */
+static char *put_line(char *p, Decimal *dec, uint64_t address, uint32_t value) {
+    memcpy(p, "  0x", 4);
+    p = put_address(p + 4, address);
+    memcpy(p, " (", 2);
+    p += 2;
+    if ((int64_t) address >= 0) {
+        memcpy(p, dec->digits + dec->first, 23 - dec->first);
+        p += 23 - dec->first;
+        decimal_add4(dec);
+    } else {
+        p += sprintf(p, "%" PRId64, (int64_t) address);
+    }
+    memcpy(p, ") : 0x", 6);
+    p = put_hex(p + 6, value);
+    *p++ = '\n';
+    return p;
+}
+
+/**
+ * @brief Starts a listing; returns the number of words in [start, stop].
+ */
+static uint64_t begin(uint64_t start, uint64_t stop, Decimal *dec) {
+    if (buffer == NULL && (buffer = malloc(DUMP_BUFFER_SIZE)) == NULL)
+        return 0;
+
+    used += snprintf(buffer + used, DUMP_BUFFER_SIZE - used,
+                     "\nMemory content [0x%08" PRIx64 "..0x%08" PRIx64 "] :\n"
+                     "-------------------------------------\n", start, stop);
+    decimal_set(dec, start);
+    return stop >= start ? (stop - start) / 4 + 1 : 0;
+}
+
+static void end(FILE *out, FILE *copy) {
+    if (buffer == NULL)
+        return;
+    buffer[used++] = '\n';
+    flush(out, copy);
+}
+
+/**
+ * @brief Formats the mdump listing of [start, stop] and writes it out.
+ */
+void dump_memory(FILE *out, FILE *copy, uint64_t start, uint64_t stop) {
+    uint64_t address = start;
+    Decimal dec;
+    uint64_t left = begin(start, stop, &dec);
+
+    while (left > 0) {
+        uint64_t room = 0, next, n;
+        const uint8_t *host = region_at(address, &room, &next);
+
+        // A stretch of words inside one region, or up to the next one.
+        if (host != NULL)
+            n = (room + 3) / 4;
+        else
+            n = next == UINT64_MAX ? left : (next - address + 3) / 4;
+        if (n > left)
+            n = left;
+        left -= n;
+
+        for (; n > 0; n--, address += 4, host += host ? 4 : 0) {
+            uint32_t value;
+
+            if (host != NULL) {
+                memcpy(&value, host, 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+                value = __builtin_bswap32(value);
+#endif
+            } else {
+                value = mem_read_32(address);
+            }
+
+            used = put_line(buffer + used, &dec, address, value) - buffer;
+            if (used > DUMP_BUFFER_SIZE - LINE_MAX_BYTES)
+                flush(out, copy);
+        }
+    }
+    end(out, copy);
+}
+
+/**
+ * @brief Copies the words of [start, stop] out of guest memory.
+ */
+uint32_t *dump_copy(uint64_t start, uint64_t stop, uint64_t *count) {
+    uint64_t address = start, left, i = 0;
+    uint32_t *words;
+
+    left = stop >= start ? (stop - start) / 4 + 1 : 0;
+    if (left > DUMP_COPY_MAX_WORDS || (words = malloc(left * 4 + 4)) == NULL)
+        return NULL;
+    *count = left;
+
+    while (left > 0) {
+        uint64_t room = 0, next, n;
+        const uint8_t *host = region_at(address, &room, &next);
+
+        if (host != NULL) {
+            // Whole stretch in one go; the region slack covers a final partial word.
+            n = (room + 3) / 4;
+            if (n > left)
+                n = left;
+            memcpy(words + i, host, n * 4);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            for (uint64_t k = i; k < i + n; k++)
+                words[k] = __builtin_bswap32(words[k]);
+#endif
+            i += n;
+            address += n * 4;
+        } else {
+            n = next == UINT64_MAX ? left : (next - address + 3) / 4;
+            if (n > left)
+                n = left;
+            for (uint64_t k = 0; k < n; k++, address += 4)
+                words[i++] = mem_read_32(address);
+        }
+        left -= n;
+    }
+    return words;
+}
+
+/**
+ * @brief Formats the mdump listing of [start, stop] from copied words.
+ */
+void dump_words(FILE *out, FILE *copy, uint64_t start, uint64_t stop, const uint32_t *words) {
+    uint64_t address = start, i;
+    Decimal dec;
+    uint64_t count = begin(start, stop, &dec);
+
+    for (i = 0; i < count; i++, address += 4) {
+        used = put_line(buffer + used, &dec, address, words[i]) - buffer;
+        if (used > DUMP_BUFFER_SIZE - LINE_MAX_BYTES)
+            flush(out, copy);
+    }
+    end(out, copy);
+}
+
+/**
+ * @brief Formats the rdump listing of a register file.
+ */
+void dump_registers(FILE *out, FILE *copy, const CPU_State *cpu, uint64_t icount,
+                    const char *symbol, uint64_t offset) {
+    char text[2048];
+    int n = 0, k;
+
+    n += snprintf(text + n, sizeof(text) - n, "\nCurrent register/bus values :\n"
+                  "-------------------------------------\n"
+                  "Instruction Count : %" PRIu64 "\n"
+                  "PC                : 0x%" PRIx64 "\n", icount, cpu->PC);
+    if (dump_symbols && symbol != NULL)
+        n += snprintf(text + n, sizeof(text) - n, "Symbol            : %s+0x%" PRIx64 "\n",
+                      symbol, offset);
+    n += snprintf(text + n, sizeof(text) - n, "Registers:\n");
+    for (k = 0; k < ARM_REGS; k++)
+        n += snprintf(text + n, sizeof(text) - n, "X%d: 0x%" PRIx64 "\n", k, cpu->REGS[k]);
+    n += snprintf(text + n, sizeof(text) - n, "FLAG_N: %d\nFLAG_Z: %d\n\n",
+                  cpu->FLAG_N, cpu->FLAG_Z);
+    if (n > (int) sizeof(text) - 1)
+        n = sizeof(text) - 1;
+
+    fwrite(text, 1, n, out);
+    if (copy != NULL)
+        fwrite(text, 1, n, copy);
+}
+
+// final version
@@ -0,0 +1,71 @@
+/**
+ * @file dump.h
+ * @brief Bulk memory dump formatting.
+ */
+
+#ifndef DUMP_H
+#define DUMP_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "shell.h"
+
+#define DUMP_BUFFER_SIZE (1 << 20)      ///< Output is formatted into chunks this big
+#define DUMP_COPY_MAX_WORDS (1 << 24)   ///< Largest range dump_copy() takes (64 MB)
+
+/**
+ * @brief Writes the mdump listing of [start, stop] to one or two streams.
+ *
+ * The text is byte-for-byte what the shell's mdump always printed, but
+ * words come straight from the region buffers, hex digits are produced
+ * eight at a time, the decimal address column is advanced in place, and
+ * each chunk is formatted once and written to both streams.
+ *
+ * The caller suspends watchpoints around the call.
+ *
+ * @param out   First destination (usually stdout).
+ * @param copy  Second destination, or NULL.
+ * @param start First word address.
+ * @param stop  Last word address (inclusive).
+ */
+void dump_memory(FILE *out, FILE *copy, uint64_t start, uint64_t stop);
+
+/**
+ * @brief Copies the words of [start, stop] out of guest memory so they can
+ *        be formatted later, away from the simulation.
+ *
+ * Region stretches are copied with memcpy; other addresses are read with
+ * mem_read_32. The caller suspends watchpoints around the call.
+ *
+ * @param count Receives the number of words copied.
+ * @return uint32_t* Words (free with free()), or NULL if the range is
+ *         larger than DUMP_COPY_MAX_WORDS or memory ran out.
+ */
+uint32_t *dump_copy(uint64_t start, uint64_t stop, uint64_t *count);
+
+/**
+ * @brief Writes the mdump listing of [start, stop] from words returned by
+ *        dump_copy(). The text is the same as dump_memory() produces.
+ */
+void dump_words(FILE *out, FILE *copy, uint64_t start, uint64_t stop, const uint32_t *words);
+
+/**
+ * @brief Adds a "Symbol" line to register dumps. Off by default, so rdump
+ *        and dumpsim output stay identical to the reference simulator's.
+ *        Set by --dump-symbols.
+ */
+extern int dump_symbols;
+
+/**
+ * @brief Writes the rdump listing of a register file to one or two streams.
+ *
+ * @param symbol Name of the symbol containing the PC, or NULL. Printed
+ *               only when dump_symbols is set.
+ * @param offset PC offset from that symbol.
+ */
+void dump_registers(FILE *out, FILE *copy, const CPU_State *cpu, uint64_t icount,
+                    const char *symbol, uint64_t offset);
+
+#endif // DUMP_H
+
+// final version
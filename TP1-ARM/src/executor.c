@@ -6,6 +6,7 @@
 #include "shell.h"
 #include "executor.h"
 #include "decoder.h"
+#include "pmu.h"
 #include <string.h>
 #include <stdint.h>
 
@@ -29,6 +30,7 @@ void set_flags(int64_t result) {
  */
 uint64_t execute(const Instruction* inst) {
     uint64_t offset = 0;
+    int taken = 0;   // A direct branch was taken, maybe to itself
 
     // Arithmetic and logic with flags
     if (strcmp(inst->name, "ADDS_IMM") == 0) {
@@ -61,6 +63,7 @@ uint64_t execute(const Instruction* inst) {
     // Arithmetic and logic without flags
     else if (strcmp(inst->name, "MUL") == 0) {
         NEXT_STATE.REGS[inst->Rd] = CURRENT_STATE.REGS[inst->Rn] * CURRENT_STATE.REGS[inst->Rm];
+        pmu_stalls += PMU_MUL_STALL;
     } else if (strcmp(inst->name, "MOVZ") == 0) {
         NEXT_STATE.REGS[inst->Rd] = ((uint64_t)inst->imm) << inst->shift;
     } else if (strcmp(inst->name, "ADD") == 0) {
@@ -90,7 +93,9 @@ uint64_t execute(const Instruction* inst) {
     // Branches and control flow
     else if (strcmp(inst->name, "B") == 0) {
         offset = inst->imm;
+        taken = 1;
     } else if (strcmp(inst->name, "BR") == 0) {
+        pmu_stalls += PMU_BRANCH_STALL;
         return PC_DIRECT_JUMP;
     } else if (strcmp(inst->name, "B.cond") == 0) {
         int take_branch = 0;
@@ -102,27 +107,44 @@ uint64_t execute(const Instruction* inst) {
             case 12: take_branch = (CURRENT_STATE.FLAG_Z == 0 && CURRENT_STATE.FLAG_N == 0); break; // GT
             case 13: take_branch = !(CURRENT_STATE.FLAG_Z == 0 && CURRENT_STATE.FLAG_N == 0); break; // LE
         }
-        if (take_branch) return inst->imm;
+        if (take_branch) {
+            offset = inst->imm;
+            taken = 1;
+        }
     } else if (strcmp(inst->name, "CBZ") == 0) {
-        if (CURRENT_STATE.REGS[inst->Rn] == 0) return inst->imm;
+        if (CURRENT_STATE.REGS[inst->Rn] == 0) {
+            offset = inst->imm;
+            taken = 1;
+        }
     } else if (strcmp(inst->name, "CBNZ") == 0) {
-        if (CURRENT_STATE.REGS[inst->Rn] != 0) return inst->imm;
+        if (CURRENT_STATE.REGS[inst->Rn] != 0) {
+            offset = inst->imm;
+            taken = 1;
+        }
     } else if (strcmp(inst->name, "HLT") == 0) {
         RUN_BIT = 0;
     }
 
+    // System registers
+    else if (strcmp(inst->name, "MRS") == 0) {
+        NEXT_STATE.REGS[inst->Rt] = pmu_read(inst->opcode);
+    }
+
     // Memory instructions
     else if (strcmp(inst->name, "LDUR") == 0) {
         uint64_t addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
         uint64_t low = mem_read_32(addr);
         uint64_t high = mem_read_32(addr + 4);
         NEXT_STATE.REGS[inst->Rt] = (high << 32) | low;
+        pmu_stalls += PMU_LOAD_STALL;
     } else if (strcmp(inst->name, "LDURB") == 0) {
         uint64_t addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
         NEXT_STATE.REGS[inst->Rt] = mem_read_32(addr) & 0xFF;
+        pmu_stalls += PMU_LOAD_STALL;
     } else if (strcmp(inst->name, "LDURH") == 0) {
         uint64_t addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
         NEXT_STATE.REGS[inst->Rt] = mem_read_32(addr) & 0xFFFF;
+        pmu_stalls += PMU_LOAD_STALL;
     } else if (strcmp(inst->name, "STUR") == 0) {
         uint64_t addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
         uint64_t val = CURRENT_STATE.REGS[inst->Rt];
@@ -146,6 +168,12 @@ uint64_t execute(const Instruction* inst) {
         mem_write_32(addr & ~0x3, word);
     }
 
+    if (taken)
+        pmu_stalls += PMU_BRANCH_STALL;
+    // An offset of 0 means "next instruction", so a branch to itself ("b .")
+    // jumps to its target instead, which the decoder set to its own PC.
+    if (taken && offset == 0)
+        return PC_DIRECT_JUMP;
     return offset;
 }
 
@@ -20,7 +20,8 @@
  * @param inst Pointer to the decoded instruction.
  * @return uint64_t 
  *         - Relative offset to add to the PC (e.g., for B, CBZ),
- *         - PC_DIRECT_JUMP to jump to a specific address (e.g., for BR),
+ *         - PC_DIRECT_JUMP to jump to inst->target_address (e.g., for BR,
+ *           or a taken branch to itself),
  *         - 0 to proceed to the next instruction sequentially.
  */
 uint64_t execute(const Instruction* inst);
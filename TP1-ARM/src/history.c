@@ -0,0 +1,206 @@
+/**
+ * @file history.c
+ * @brief Flight recorder: the last HISTORY_SIZE retired instructions.
+ */
+
+#include "history.h"
+#include "shell.h"
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <inttypes.h>
+
+#define HISTORY_LINE 128   ///< Longest formatted entry
+
+// Encodings whose register operand is Rt rather than Rd.
+#define IS_LOAD_STORE(raw) (((raw) & 0x0a000000) == 0x08000000)
+#define IS_MRS(raw)        (((raw) & 0xfff00000) == 0xd5300000)
+
+static HistoryEntry ring[HISTORY_SIZE] __attribute__((aligned(64)));
+static const char *history_path;
+
+static const int FATAL_SIGNALS[] = {
+    SIGINT, SIGTERM, SIGQUIT, SIGHUP, SIGABRT, SIGBUS, SIGFPE, SIGILL, SIGSEGV
+};
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * RECORDING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void history_record(uint64_t pc, uint32_t raw, const Instruction *inst) {
+    HistoryEntry *e = &ring[INSTRUCTION_COUNT & (HISTORY_SIZE - 1)];
+    uint32_t reg = IS_LOAD_STORE(raw) || IS_MRS(raw) ? inst->Rt : inst->Rd;
+
+    e->pc = pc;
+    e->value = NEXT_STATE.REGS[reg];
+    e->addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
+    e->raw = raw;
+    e->reg = reg;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FORMATTING
+ *
+ * No stdio here: the same code runs inside signal handlers.
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static char *put_str(char *p, const char *s, int width) {
+    while (*s) {
+        *p++ = *s++;
+        width--;
+    }
+    while (width-- > 0)
+        *p++ = ' ';
+    return p;
+}
+
+static char *put_dec(char *p, uint64_t v, int width) {
+    char digits[20];
+    int n = 0;
+
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    while (width-- > n)
+        *p++ = ' ';
+    while (n > 0)
+        *p++ = digits[--n];
+    return p;
+}
+
+static char *put_hex(char *p, uint64_t v, int digits) {
+    int i;
+
+    *p++ = '0';
+    *p++ = 'x';
+    for (i = digits - 1; i >= 0; i--)
+        *p++ = "0123456789abcdef"[(v >> (4 * i)) & 0xf];
+    return p;
+}
+
+/**
+ * @brief Formats entry number seq; returns its length.
+ */
+static int format_entry(char *buf, uint64_t seq, const HistoryEntry *e) {
+    Instruction inst = decode(e->raw);
+    int access = inst.valid && (strncmp(inst.name, "LDUR", 4) == 0 || strncmp(inst.name, "STUR", 4) == 0);
+    // XZR (x31) discards what is written to it, which is how compares are decoded.
+    int writes = inst.valid && !inst_ends_block(&inst) && e->reg != 31;
+    char *p = buf;
+
+    p = put_dec(p, seq, 12);
+    p = put_str(p, "  ", 0);
+    p = put_hex(p, e->pc, 8);
+    p = put_str(p, "  ", 0);
+    p = put_hex(p, e->raw, 8);
+    p = put_str(p, "  ", 0);
+    p = put_str(p, inst.valid ? inst.name : "(unknown)", writes || access ? 10 : 0);
+
+    if (writes) {
+        p = put_str(p, " x", 0);
+        p = put_dec(p, e->reg, 0);
+        p = put_str(p, "=", 0);
+        p = put_hex(p, e->value, 16);
+    }
+    if (access) {
+        p = put_str(p, "  [", 0);
+        p = put_hex(p, e->addr, 8);
+        p = put_str(p, "]", 0);
+    }
+    *p++ = '\n';
+    return (int) (p - buf);
+}
+
+/**
+ * @brief Writes the header and the last count entries to fd.
+ */
+static void write_entries(int fd, const char *why, uint64_t count) {
+    char line[HISTORY_LINE], *p = line;
+    uint64_t kept = INSTRUCTION_COUNT < HISTORY_SIZE ? INSTRUCTION_COUNT : HISTORY_SIZE, seq;
+
+    if (count == 0 || count > kept)
+        count = kept;
+    p = put_str(p, why, 0);
+    p = put_str(p, "last ", 0);
+    p = put_dec(p, count, 0);
+    p = put_str(p, " of ", 0);
+    p = put_dec(p, INSTRUCTION_COUNT, 0);
+    p = put_str(p, " instructions, oldest first\n", 0);
+    if (write(fd, line, p - line) < 0)
+        return;
+
+    for (seq = INSTRUCTION_COUNT - count; seq < INSTRUCTION_COUNT; seq++) {
+        int n = format_entry(line, seq, &ring[seq & (HISTORY_SIZE - 1)]);
+        if (write(fd, line, n) < 0)
+            return;
+    }
+    if (write(fd, "\n", 1) < 0)
+        return;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * DUMPS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void history_dump(FILE *out, unsigned count) {
+    fflush(out);
+    write_entries(fileno(out), "History: ", count);
+}
+
+void history_stopped(FILE *out) {
+    int fd;
+
+    if (history_path == NULL) {
+        history_dump(out, HISTORY_TAIL);
+        return;
+    }
+    if ((fd = open(history_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(out, "Can't write history to %s\n\n", history_path);
+        return;
+    }
+    write_entries(fd, "History: ", 0);
+    close(fd);
+    fprintf(out, "History written to %s\n\n", history_path);
+}
+
+void history_set_file(const char *path) {
+    history_path = path;
+}
+
+void history_crash(int sig) {
+    char why[32], *p = why;
+    int fd = 2;
+
+    p = put_str(p, "Signal ", 0);
+    p = put_dec(p, sig, 0);
+    p = put_str(p, ": ", 0);
+    *p = '\0';
+
+    if (history_path != NULL && (fd = open(history_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) >= 0) {
+        write_entries(fd, why, 0);
+        close(fd);
+    } else {
+        write_entries(2, why, HISTORY_TAIL);
+    }
+}
+
+static void history_signal(int sig) {
+    history_crash(sig);
+    raise(sig);   // the handler was reset: delivered with the default action on return
+}
+
+void history_catch_signals() {
+    struct sigaction sa;
+    unsigned i;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = history_signal;
+    sa.sa_flags = SA_RESETHAND;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0; i < sizeof(FATAL_SIGNALS) / sizeof(FATAL_SIGNALS[0]); i++)
+        sigaction(FATAL_SIGNALS[i], &sa, NULL);
+}
+
+// final version
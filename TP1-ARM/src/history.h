@@ -0,0 +1,80 @@
+/**
+ * @file history.h
+ * @brief Flight recorder: the last HISTORY_SIZE retired instructions.
+ *
+ * Every instruction writes one 32-byte entry, two per cache line, at
+ * INSTRUCTION_COUNT modulo the ring size. The store is unconditional. The
+ * register is picked from the encoding class: Rt for loads, stores and
+ * MRS, Rd for everything else, and its new value is kept. For a store
+ * that register is the one stored. The address is Rn + imm, which for
+ * loads and stores is the guest address they used. Which of these fields
+ * mean something is only worked out, from the raw word, when the ring is
+ * printed: branches, HLT and writes to XZR (compares) show no register.
+ *
+ * The tail of the ring is printed when a run is stopped by a limit, a
+ * trap or a stuck loop, and when a fatal signal or an interrupt ends the
+ * simulator. With --history-file the whole ring goes to that file instead.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "decoder.h"
+#include <stdint.h>
+#include <stdio.h>
+
+#define HISTORY_SIZE 4096   ///< Entries kept; a power of two
+#define HISTORY_TAIL 32     ///< Entries printed by an automatic dump
+
+/**
+ * @struct HistoryEntry
+ * @brief One retired instruction.
+ */
+typedef struct {
+    uint64_t pc;
+    uint64_t value;    ///< Register reg after the instruction
+    uint64_t addr;     ///< Rn + imm before it
+    uint32_t raw;
+    uint32_t reg;
+} HistoryEntry;
+
+/**
+ * @brief Records a retired instruction. Called by process_instruction()
+ *        before CURRENT_STATE is updated.
+ */
+void history_record(uint64_t pc, uint32_t raw, const Instruction *inst);
+
+/**
+ * @brief Prints the most recent entries, oldest first.
+ *
+ * @param out   Destination.
+ * @param count Entries wanted; 0 or more than are kept means all.
+ */
+void history_dump(FILE *out, unsigned count);
+
+/**
+ * @brief Automatic dump after a run was stopped: the tail to out, or the
+ *        whole ring to the --history-file.
+ */
+void history_stopped(FILE *out);
+
+/**
+ * @brief Sends automatic dumps to a file instead of the console.
+ */
+void history_set_file(const char *path);
+
+/**
+ * @brief Installs handlers that dump the ring when a fatal signal or an
+ *        interrupt ends the simulator, then let the signal take its course.
+ */
+void history_catch_signals();
+
+/**
+ * @brief The dump done by those handlers, for other handlers that give up
+ *        on a signal (the watchpoint SIGSEGV handler). Async-signal-safe.
+ */
+void history_crash(int sig);
+
+#endif // HISTORY_H
+
+// final version
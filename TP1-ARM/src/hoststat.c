@@ -0,0 +1,287 @@
+/**
+ * @file hoststat.c
+ * @brief Host performance counters attributed to the simulator's phases.
+ */
+
+#include "hoststat.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define HOST_EVENTS 5          ///< Entries in EVENTS
+#define HOST_CALIBRATION 256   ///< Back-to-back reads timed when starting
+
+/**
+ * @struct OpcodeRow
+ * @brief Totals for one guest opcode.
+ */
+typedef struct {
+    char name[16];
+    uint64_t retired;
+    uint64_t sum[HOST_PHASES][HOST_EVENTS];
+} OpcodeRow;
+
+static const char *PHASE_NAMES[HOST_PHASES] = { "fetch", "decode", "execute", "copy" };
+
+int hoststats;
+
+static int fds[HOST_EVENTS];             ///< Open counters, in group order
+static int slot[HOST_EVENTS] = { -1, -1, -1, -1, -1 };   ///< Group position, or -1
+static int nopen;
+static uint64_t last[HOST_EVENTS];       ///< Values at the previous read
+static uint64_t overhead[HOST_EVENTS];   ///< Cost of one read, per event
+static uint64_t current[HOST_PHASES][HOST_EVENTS];
+static OpcodeRow rows[HOST_OPCODES];
+static int nrows, row;
+
+#ifdef __linux__
+
+/**
+ * @brief Counted events. Task-clock only stands in when there are no cycles.
+ */
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} EVENTS[HOST_EVENTS] = {
+    { "cycles",          PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch-misses",   PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { "L1D-read-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+                                             | PERF_COUNT_HW_CACHE_OP_READ << 8
+                                             | PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+    { "task-clock-ns",   PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+static int open_event(int e) {
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = EVENTS[e].type;
+    attr.config = EVENTS[e].config;
+    attr.disabled = nopen == 0;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, nopen ? fds[0] : -1, 0);
+}
+
+/**
+ * @brief Reads the whole group into values, indexed by event. values is
+ *        left alone if the read fails.
+ */
+static void read_counters(uint64_t values[HOST_EVENTS]) {
+    uint64_t buf[1 + HOST_EVENTS];
+    int e;
+
+    if (read(fds[0], buf, sizeof(buf)) < (ssize_t) ((1 + nopen) * sizeof(uint64_t)))
+        return;
+    for (e = 0; e < HOST_EVENTS; e++)
+        values[e] = slot[e] >= 0 ? buf[1 + slot[e]] : 0;
+}
+
+static const char *event_name(int e) {
+    return EVENTS[e].name;
+}
+
+#else
+
+static void read_counters(uint64_t values[HOST_EVENTS]) {
+    (void) values;
+}
+
+static const char *event_name(int e) {
+    (void) e;
+    return "";
+}
+
+#endif
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * COUNTING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int hoststat_start(FILE *err) {
+#ifdef __linux__
+    uint64_t a[HOST_EVENTS] = { 0 }, b[HOST_EVENTS] = { 0 };
+    int e, i;
+
+    if (nopen > 0) {
+        hoststats = 1;
+        return 0;
+    }
+
+    for (e = 0; e < HOST_EVENTS; e++) {
+        slot[e] = -1;
+        if (e == HOST_EVENTS - 1 && slot[0] >= 0)
+            break;
+        if ((fds[nopen] = open_event(e)) < 0) {
+            if (e < HOST_EVENTS - 1)
+                fprintf(err, "Host counter %s unavailable (%s)\n", EVENTS[e].name, strerror(errno));
+            continue;
+        }
+        slot[e] = nopen++;
+    }
+    if (nopen == 0)
+        return -1;
+
+    ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+    for (e = 0; e < HOST_EVENTS; e++)
+        overhead[e] = UINT64_MAX;
+    for (i = 0; i < HOST_CALIBRATION; i++) {
+        read_counters(a);
+        read_counters(b);
+        for (e = 0; e < HOST_EVENTS; e++)
+            if (b[e] - a[e] < overhead[e])
+                overhead[e] = b[e] - a[e];
+    }
+
+    hoststats = 1;
+    return 0;
+#else
+    fprintf(err, "Host counters need Linux perf_event_open\n");
+    return -1;
+#endif
+}
+
+void hoststat_stop() {
+#ifdef __linux__
+    int i;
+
+    for (i = nopen - 1; i >= 0; i--)
+        close(fds[i]);
+#endif
+    nopen = 0;
+    hoststats = 0;
+}
+
+void hoststat_begin() {
+    read_counters(last);
+}
+
+void hoststat_mark(int phase) {
+    uint64_t now[HOST_EVENTS];
+    int e;
+
+    memcpy(now, last, sizeof(now));
+    read_counters(now);
+    for (e = 0; e < HOST_EVENTS; e++) {
+        current[phase][e] += now[e] - last[e];
+        last[e] = now[e];
+    }
+}
+
+void hoststat_opcode(const char *name) {
+    if (row < nrows && strcmp(rows[row].name, name) == 0)
+        return;
+
+    for (row = 0; row < nrows; row++)
+        if (strcmp(rows[row].name, name) == 0)
+            return;
+
+    if (nrows < HOST_OPCODES - 1) {
+        snprintf(rows[row].name, sizeof(rows[row].name), "%s", name);
+        nrows++;
+    } else {
+        row = HOST_OPCODES - 1;
+        strcpy(rows[row].name, "(other)");
+        nrows = HOST_OPCODES;
+    }
+}
+
+void hoststat_retire() {
+    int p, e;
+
+    hoststat_mark(HOST_COPY);
+    rows[row].retired++;
+    for (p = 0; p < HOST_PHASES; p++)
+        for (e = 0; e < HOST_EVENTS; e++) {
+            rows[row].sum[p][e] += current[p][e];
+            current[p][e] = 0;
+        }
+}
+
+void hoststat_reset() {
+    memset(rows, 0, sizeof(rows));
+    memset(current, 0, sizeof(current));
+    nrows = row = 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REPORT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int by_retired(const void *a, const void *b) {
+    const OpcodeRow *x = a, *y = b;
+    return x->retired < y->retired ? 1 : x->retired > y->retired ? -1 : 0;
+}
+
+/**
+ * @brief Mean per instruction of one phase, less the cost of the read.
+ */
+static double mean(const OpcodeRow *r, int phase, int e) {
+    double cost = (double) r->sum[phase][e] - (double) overhead[e] * r->retired;
+    return r->retired && cost > 0 ? cost / r->retired : 0.0;
+}
+
+void hoststat_report(FILE *out) {
+    OpcodeRow sorted[HOST_OPCODES], all;
+    int i, p, e, n = 0;
+
+    if (nopen == 0 && nrows == 0) {
+        fprintf(out, "Host counters are off (start them with --hoststats or 'hoststats on')\n\n");
+        return;
+    }
+
+    memcpy(sorted, rows, nrows * sizeof(OpcodeRow));
+    qsort(sorted, nrows, sizeof(OpcodeRow), by_retired);
+    memset(&all, 0, sizeof(all));
+    strcpy(all.name, "(all)");
+    for (i = 0; i < nrows; i++) {
+        all.retired += sorted[i].retired;
+        for (p = 0; p < HOST_PHASES; p++)
+            for (e = 0; e < HOST_EVENTS; e++)
+                all.sum[p][e] += sorted[i].sum[p][e];
+    }
+
+    fprintf(out, "Host counters: %" PRIu64 " instructions, user mode, "
+            "mean per instruction with the read cost removed\n\n", all.retired);
+
+    for (e = 0; e < HOST_EVENTS; e++) {
+        if (slot[e] < 0)
+            continue;
+        n++;
+        fprintf(out, "%s (read cost %" PRIu64 "):\n", event_name(e), overhead[e]);
+        fprintf(out, "  %-10s %12s", "opcode", "retired");
+        for (p = 0; p < HOST_PHASES; p++)
+            fprintf(out, " %10s", PHASE_NAMES[p]);
+        fprintf(out, " %10s\n", "total");
+
+        for (i = 0; i <= nrows; i++) {
+            const OpcodeRow *r = i < nrows ? &sorted[i] : &all;
+            double total = 0.0;
+
+            fprintf(out, "  %-10s %12" PRIu64, r->name, r->retired);
+            for (p = 0; p < HOST_PHASES; p++) {
+                fprintf(out, " %10.1f", mean(r, p, e));
+                total += mean(r, p, e);
+            }
+            fprintf(out, " %10.1f\n", total);
+        }
+        fprintf(out, "\n");
+    }
+    if (n == 0)
+        fprintf(out, "No host counters are open\n\n");
+}
+
+// final version
@@ -0,0 +1,82 @@
+/**
+ * @file hoststat.h
+ * @brief Host performance counters attributed to the simulator's phases.
+ *
+ * With Linux perf_event_open, host cycles, instructions, branch misses and
+ * L1D read misses of the simulator itself are counted in user mode. The
+ * counters are read at the boundaries of fetch, decode, execute and the
+ * state copy in cycle(), and each instruction's deltas are added to its
+ * guest opcode's row. Counters the host can't provide are reported as
+ * unavailable. If there are no CPU cycles, task-clock nanoseconds are
+ * counted instead.
+ *
+ * Each boundary is a read() of the counter group. The cheapest observed
+ * back-to-back read is measured when counting starts and subtracted from
+ * every phase. The copy phase also covers whatever cycle() does between
+ * execute and the copy, such as the execution profiler when it is on.
+ */
+
+#ifndef HOSTSTAT_H
+#define HOSTSTAT_H
+
+#include <stdio.h>
+
+/**
+ * @brief Simulator phases, in the order they run.
+ */
+enum { HOST_FETCH, HOST_DECODE, HOST_EXECUTE, HOST_COPY, HOST_PHASES };
+
+#define HOST_OPCODES 48   ///< Opcode rows; later ones are folded into "(other)"
+
+/**
+ * @brief Enables counting. Checked by process_instruction() and cycle().
+ */
+extern int hoststats;
+
+/**
+ * @brief Opens the counters and starts counting.
+ *
+ * @param err Receives one line per counter the host can't provide.
+ * @return int 0 on success, -1 if no counter could be opened.
+ */
+int hoststat_start(FILE *err);
+
+/**
+ * @brief Stops counting and closes the counters; totals are kept.
+ */
+void hoststat_stop();
+
+/**
+ * @brief Reads the counters at the start of an instruction.
+ */
+void hoststat_begin();
+
+/**
+ * @brief Charges the counts since the previous read to a phase.
+ */
+void hoststat_mark(int phase);
+
+/**
+ * @brief Names the opcode the current instruction's counts belong to.
+ */
+void hoststat_opcode(const char *name);
+
+/**
+ * @brief Ends the copy phase and adds the instruction to its opcode row.
+ */
+void hoststat_retire();
+
+/**
+ * @brief Zeroes every total.
+ */
+void hoststat_reset();
+
+/**
+ * @brief Prints, per counter, the mean cost of each phase per retired
+ *        instruction of each opcode.
+ */
+void hoststat_report(FILE *out);
+
+#endif // HOSTSTAT_H
+
+// final version
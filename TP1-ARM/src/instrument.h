@@ -0,0 +1,90 @@
+/**
+ * @file instrument.h
+ * @brief Compile-time instrumentation points of the simulation loop.
+ *
+ * SIM_INSTRUMENT picks what the hot loop contains:
+ *
+ *   INSTRUMENT_NONE   nothing: each point expands to an empty statement (sim)
+ *   INSTRUMENT_PROF   counters: execution profile, coverage, host counters (sim-prof)
+ *   INSTRUMENT_TRACE  counters, plugin events and the timeline (sim-trace)
+ *
+ * At a given level the hooks still test their runtime switch, so a tool is
+ * only paid for once it is turned on. Below its level the tool can't be
+ * turned on at all and its options say so. Undefined means the full set,
+ * for builds that don't go through the Makefile.
+ */
+
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+#include "profile.h"
+#include "coverage.h"
+#include "hoststat.h"
+#include "plugin.h"
+#include "timeline.h"
+
+#define INSTRUMENT_NONE  0
+#define INSTRUMENT_PROF  1
+#define INSTRUMENT_TRACE 2
+
+#ifndef SIM_INSTRUMENT
+#define SIM_INSTRUMENT INSTRUMENT_TRACE
+#endif
+
+#if SIM_INSTRUMENT >= INSTRUMENT_PROF
+#define PROF_HOOK(on, call) do { if (on) call; } while (0)
+#else
+#define PROF_HOOK(on, call) do { } while (0)
+#endif
+
+#if SIM_INSTRUMENT >= INSTRUMENT_TRACE
+#define TRACE_HOOK(on, call) do { if (on) call; } while (0)
+// The plugins' PLUGIN_RETIRE inline counters, bumped without a call.
+#define COUNT_RETIRED() do { \
+    int i_; \
+    for (i_ = 0; i_ < plugin_retire_ncounters; i_++) \
+        (*plugin_retire_counters[i_])++; \
+} while (0)
+#else
+#define TRACE_HOOK(on, call) do { } while (0)
+#define COUNT_RETIRED() do { } while (0)
+#endif
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * INSTRUMENTATION POINTS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/** Before the fetch. */
+#define INSTR_BEGIN() \
+    PROF_HOOK(hoststats, hoststat_begin())
+
+/** After the fetch. */
+#define INSTR_FETCH() \
+    PROF_HOOK(hoststats, hoststat_mark(HOST_FETCH))
+
+/** After the decode. */
+#define INSTR_DECODE(inst) \
+    PROF_HOOK(hoststats, (hoststat_mark(HOST_DECODE), \
+                          hoststat_opcode((inst)->valid ? (inst)->name : "(unknown)")))
+
+/** After the execute, before CURRENT_STATE moves on. Memory access and
+ *  branch events are raised here from the decoded instruction. */
+#define INSTR_EXECUTE(inst, raw, pc, next) do { \
+    TRACE_HOOK(plugin_mask, plugin_retire(inst, raw, pc, next)); \
+    COUNT_RETIRED(); \
+    TRACE_HOOK(timelining, timeline_retire(inst, pc, next)); \
+    PROF_HOOK(hoststats, hoststat_mark(HOST_EXECUTE)); \
+} while (0)
+
+/** In cycle(), around the CURRENT_STATE copy. */
+#define INSTR_RETIRE(pc, next) do { \
+    PROF_HOOK(profiling, profile_retire(pc, next)); \
+    PROF_HOOK(covering, coverage_retire(pc, next)); \
+} while (0)
+
+#define INSTR_COPIED() \
+    PROF_HOOK(hoststats, hoststat_retire())
+
+#endif // INSTRUMENT_H
+
+// final version
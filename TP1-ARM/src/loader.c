@@ -0,0 +1,574 @@
+/**
+ * @file loader.c
+ * @brief Program image loaders.
+ */
+
+#include "loader.h"
+#include "memory.h"
+#include "asm.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SWAR_ONES  0x0101010101010101ull
+#define SWAR_HIGH  0x8080808080808080ull
+
+static Symbol *symbols;     ///< Sorted by address
+static int nsymbols;
+
+/**
+ * @struct SourceMap
+ * @brief Where the text of one loaded image came from.
+ */
+typedef struct {
+    char *path;
+    uint64_t start, size;
+    int *lines;             ///< Line of each word, or NULL for one word per line
+} SourceMap;
+
+static SourceMap *sources;
+static int nsources;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * INPUT BUFFERS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @struct Source
+ * @brief A whole input file in memory, either mapped or read.
+ */
+typedef struct {
+    const char *data;
+    uint64_t size;
+    int mapped;
+} Source;
+
+/**
+ * @brief Maps a regular file, or reads a stream ("-", pipes) to the end.
+ */
+static int source_open(const char *path, Source *src) {
+    struct stat st;
+    int fd = strcmp(path, "-") == 0 ? STDIN_FILENO : open(path, O_RDONLY);
+
+    memset(src, 0, sizeof(*src));
+    if (fd < 0)
+        return -1;
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            src->data = p;
+            src->size = st.st_size;
+            src->mapped = 1;
+            if (fd != STDIN_FILENO)
+                close(fd);
+            return 0;
+        }
+    }
+
+    uint64_t cap = 1 << 16;
+    char *buf = malloc(cap);
+    ssize_t n;
+    while (buf != NULL && (n = read(fd, buf + src->size, cap - src->size)) > 0) {
+        src->size += n;
+        if (src->size == cap) {
+            char *grown = realloc(buf, cap *= 2);
+            if (grown == NULL)
+                free(buf);
+            buf = grown;
+        }
+    }
+    if (fd != STDIN_FILENO)
+        close(fd);
+    if (buf == NULL) {
+        errno = ENOMEM;
+        return -1;
+    }
+    src->data = buf;
+    return 0;
+}
+
+/**
+ * @brief Releases a source buffer.
+ */
+static void source_close(Source *src) {
+    if (src->mapped)
+        munmap((void *) src->data, src->size);
+    else
+        free((void *) src->data);
+}
+
+/**
+ * @brief Bytes from a guest address to the end of its region, 0 if unmapped.
+ */
+static uint64_t region_room(uint64_t addr) {
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (addr >= MEM_REGIONS[i].start &&
+                addr < MEM_REGIONS[i].start + MEM_REGIONS[i].size)
+            return MEM_REGIONS[i].start + MEM_REGIONS[i].size - addr;
+    }
+    return 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * HEX PARSING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Per-byte flag set (0x80) where x >= n, for bytes below 0x80.
+ */
+#define SWAR_GE(x, n) ((x) + (0x80 - (n)) * SWAR_ONES)
+
+/**
+ * @brief Converts eight ASCII hex digits to a word, eight lanes at once.
+ *
+ * @param chars First digit is the most significant nibble.
+ * @param word  Receives the value.
+ * @return int 1 if all eight characters are hex digits, 0 otherwise.
+ */
+static int hex8_swar(const char *chars, uint32_t *word) {
+    uint64_t v;
+    memcpy(&v, chars, 8);
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+
+    if (v & SWAR_HIGH)
+        return 0;
+
+    // Digits are checked as-is, letters after folding to lower case.
+    uint64_t lower = v | (0x20 * SWAR_ONES);
+    uint64_t digit = SWAR_GE(v, '0') & ~SWAR_GE(v, '9' + 1);
+    uint64_t alpha = SWAR_GE(lower, 'a') & ~SWAR_GE(lower, 'f' + 1);
+    if (((digit | alpha) & SWAR_HIGH) != SWAR_HIGH)
+        return 0;
+
+    // '0'-'9' keep their low nibble; 'a'-'f' have bit 6 set and need +9.
+    v = (lower & (0x0F * SWAR_ONES)) + 9 * ((lower & (0x40 * SWAR_ONES)) >> 6);
+
+    // Fold nibble pairs into bytes, bytes into halves, halves into the word.
+    v = ((v & 0x000F000F000F000Full) << 4) | ((v >> 8) & 0x000F000F000F000Full);
+    v = ((v & 0x000000FF000000FFull) << 8) | ((v >> 16) & 0x000000FF000000FFull);
+    *word = (uint32_t) (((v & 0xFFFF) << 16) | ((v >> 32) & 0xFFFF));
+    return 1;
+}
+
+/**
+ * @brief Value of one hex digit, or -1.
+ */
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Whitespace as accepted by scanf between words.
+ */
+static int is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * HEX IMAGE LOADER
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Parses a hex program image straight into the region at base.
+ */
+static int load_hex(const Source *src, uint64_t base, LoadResult *result) {
+    uint8_t *dst = mem_host_ptr(base);
+    uint64_t room = region_room(base);
+    const char *p = src->data;
+    const char *end = src->data + src->size;
+    int rc = LOADER_OK;
+
+    while (1) {
+        while (p < end && is_space(*p)) {
+            if (*p == '\n')
+                result->line++;
+            p++;
+        }
+        if (p == end)
+            break;
+
+        uint32_t word = 0;
+        if (end - p >= 8 && (end - p == 8 || is_space(p[8])) && hex8_swar(p, &word)) {
+            p += 8;
+        } else {
+            // Anything else: optional 0x prefix and one to eight digits.
+            int digits = 0, d;
+            if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X') &&
+                    hex_digit(p[2]) >= 0)
+                p += 2;
+            while (p < end && (d = hex_digit(*p)) >= 0 && digits < 8) {
+                word = (word << 4) | d;
+                digits++;
+                p++;
+            }
+            if (digits == 0 || (p < end && !is_space(*p))) {
+                rc = LOADER_ERR_MALFORMED;
+                break;
+            }
+        }
+
+        if (result->size + 4 > room) {
+            rc = LOADER_ERR_TOO_BIG;
+            break;
+        }
+        dst[result->size + 0] = word;
+        dst[result->size + 1] = word >> 8;
+        dst[result->size + 2] = word >> 16;
+        dst[result->size + 3] = word >> 24;
+        result->size += 4;
+    }
+
+    mem_mark_loaded(base, result->size);
+    result->entry = base;
+    return rc;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ELF LOADER
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+// Just the ELF64 little-endian layouts we need; <elf.h> is not on macOS.
+
+#define ELF_ET_REL      1
+#define ELF_ET_EXEC     2
+#define ELF_ET_DYN      3
+#define ELF_EM_AARCH64  183
+#define ELF_PT_LOAD     1
+#define ELF_SHT_SYMTAB  2
+#define ELF_SHT_RELA    4
+#define ELF_SHT_NOBITS  8
+#define ELF_SHT_REL     9
+#define ELF_SHF_ALLOC   0x2
+#define ELF_SHF_EXEC    0x4
+#define ELF_STT_SECTION 3
+#define ELF_STT_FILE    4
+#define ELF_SHN_UNDEF   0
+
+typedef struct {
+    uint8_t  e_ident[16];
+    uint16_t e_type, e_machine;
+    uint32_t e_version;
+    uint64_t e_entry, e_phoff, e_shoff;
+    uint32_t e_flags;
+    uint16_t e_ehsize, e_phentsize, e_phnum, e_shentsize, e_shnum, e_shstrndx;
+} ElfHeader;
+
+typedef struct {
+    uint32_t p_type, p_flags;
+    uint64_t p_offset, p_vaddr, p_paddr, p_filesz, p_memsz, p_align;
+} ElfSegment;
+
+typedef struct {
+    uint32_t sh_name, sh_type;
+    uint64_t sh_flags, sh_addr, sh_offset, sh_size;
+    uint32_t sh_link, sh_info;
+    uint64_t sh_addralign, sh_entsize;
+} ElfSection;
+
+typedef struct {
+    uint32_t st_name;
+    uint8_t  st_info, st_other;
+    uint16_t st_shndx;
+    uint64_t st_value, st_size;
+} ElfSymbol;
+
+/**
+ * @brief Copies a file chunk to guest memory and zero-fills up to memsz.
+ *        The whole range must sit inside one region.
+ */
+static int elf_place(const Source *src, uint64_t addr, uint64_t offset,
+                     uint64_t filesz, uint64_t memsz, LoadResult *result) {
+    uint8_t *dst = mem_host_ptr(addr);
+
+    if (memsz == 0)
+        return LOADER_OK;
+    if (dst == NULL || memsz > region_room(addr) || filesz > memsz)
+        return LOADER_ERR_TOO_BIG;
+    if (offset > src->size || filesz > src->size - offset)
+        return LOADER_ERR_FORMAT;
+
+    memcpy(dst, src->data + offset, filesz);
+    memset(dst + filesz, 0, memsz - filesz);
+    mem_mark_loaded(addr, memsz);
+
+    if (addr >= MEM_TEXT_START && addr < MEM_TEXT_START + MEM_TEXT_SIZE)
+        result->size += memsz;
+    else
+        result->data += memsz;
+    return LOADER_OK;
+}
+
+/**
+ * @brief Orders symbols by address for symbol_lookup().
+ */
+static int symbol_cmp(const void *a, const void *b) {
+    const Symbol *x = a, *y = b;
+    return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+/**
+ * @brief Keeps the named symbols of an ELF symbol table. Section-relative
+ *        values are rebased by the addresses the sections were placed at.
+ */
+static void elf_symbols(const Source *src, const ElfSection *sections, int nsections,
+                        const uint64_t *bases, const ElfSection *symtab) {
+    uint64_t count = symtab->sh_size / sizeof(ElfSymbol);
+
+    if (symtab->sh_link >= (uint32_t) nsections)
+        return;
+    const ElfSection *strtab = &sections[symtab->sh_link];
+    if (symtab->sh_offset + symtab->sh_size > src->size ||
+            strtab->sh_offset + strtab->sh_size > src->size)
+        return;
+
+    symbols = realloc(symbols, (nsymbols + count) * sizeof(Symbol));
+    for (uint64_t k = 0; k < count; k++) {
+        ElfSymbol sym;
+        memcpy(&sym, src->data + symtab->sh_offset + k * sizeof(ElfSymbol), sizeof(sym));
+
+        int type = sym.st_info & 0xF;
+        if (sym.st_name == 0 || sym.st_name >= strtab->sh_size ||
+                type == ELF_STT_SECTION || type == ELF_STT_FILE ||
+                sym.st_shndx == ELF_SHN_UNDEF || sym.st_shndx >= nsections)
+            continue;
+
+        const char *name = src->data + strtab->sh_offset + sym.st_name;
+        Symbol *out = &symbols[nsymbols++];
+        out->addr = sym.st_value + bases[sym.st_shndx];
+        out->size = sym.st_size;
+        out->name = strndup(name, strtab->sh_size - sym.st_name);
+    }
+
+    qsort(symbols, nsymbols, sizeof(Symbol), symbol_cmp);
+}
+
+/**
+ * @brief Loads an aarch64 ELF executable or relocatable object.
+ */
+static int load_elf(const Source *src, LoadResult *result) {
+    ElfHeader eh;
+    int i, rc = LOADER_OK;
+
+    if (src->size < sizeof(eh))
+        return LOADER_ERR_FORMAT;
+    memcpy(&eh, src->data, sizeof(eh));
+
+    // 64-bit, little-endian, aarch64, and a little-endian host to read it.
+    if (eh.e_ident[4] != 2 || eh.e_ident[5] != 1 || eh.e_machine != ELF_EM_AARCH64 ||
+            __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__)
+        return LOADER_ERR_FORMAT;
+    if (eh.e_shnum && (eh.e_shentsize != sizeof(ElfSection) ||
+            eh.e_shoff + (uint64_t) eh.e_shnum * sizeof(ElfSection) > src->size))
+        return LOADER_ERR_FORMAT;
+
+    ElfSection *sections = calloc(eh.e_shnum + 1, sizeof(ElfSection));
+    uint64_t *bases = calloc(eh.e_shnum + 1, sizeof(uint64_t));
+    memcpy(sections, src->data + eh.e_shoff, eh.e_shnum * sizeof(ElfSection));
+
+    result->elf = 1;
+
+    if (eh.e_type == ELF_ET_EXEC || eh.e_type == ELF_ET_DYN) {
+        if (eh.e_phentsize != sizeof(ElfSegment) ||
+                eh.e_phoff + (uint64_t) eh.e_phnum * sizeof(ElfSegment) > src->size)
+            rc = LOADER_ERR_FORMAT;
+
+        for (i = 0; rc == LOADER_OK && i < eh.e_phnum; i++) {
+            ElfSegment ph;
+            memcpy(&ph, src->data + eh.e_phoff + i * sizeof(ElfSegment), sizeof(ph));
+            if (ph.p_type == ELF_PT_LOAD)
+                rc = elf_place(src, ph.p_vaddr, ph.p_offset, ph.p_filesz, ph.p_memsz, result);
+        }
+        result->entry = eh.e_entry;
+    } else if (eh.e_type == ELF_ET_REL) {
+        // Lay out allocated sections back to back: code in text, the rest in data.
+        uint64_t text = MEM_TEXT_START, data = MEM_DATA_START;
+
+        for (i = 0; rc == LOADER_OK && i < eh.e_shnum; i++) {
+            ElfSection *sh = &sections[i];
+            if (sh->sh_type == ELF_SHT_RELA || sh->sh_type == ELF_SHT_REL) {
+                if (sh->sh_info < eh.e_shnum && (sections[sh->sh_info].sh_flags & ELF_SHF_ALLOC))
+                    result->relocs += sh->sh_size / (sh->sh_entsize ? sh->sh_entsize : 24);
+                continue;
+            }
+            if (!(sh->sh_flags & ELF_SHF_ALLOC) || sh->sh_size == 0)
+                continue;
+
+            uint64_t *cursor = (sh->sh_flags & ELF_SHF_EXEC) ? &text : &data;
+            uint64_t align = sh->sh_addralign ? sh->sh_addralign : 1;
+            *cursor = (*cursor + align - 1) & ~(align - 1);
+            bases[i] = *cursor;
+
+            rc = elf_place(src, *cursor, sh->sh_offset,
+                           sh->sh_type == ELF_SHT_NOBITS ? 0 : sh->sh_size,
+                           sh->sh_size, result);
+            *cursor += sh->sh_size;
+        }
+        result->entry = MEM_TEXT_START;
+    } else {
+        rc = LOADER_ERR_FORMAT;
+    }
+
+    for (i = 0; rc == LOADER_OK && i < eh.e_shnum; i++) {
+        if (sections[i].sh_type == ELF_SHT_SYMTAB)
+            elf_symbols(src, sections, eh.e_shnum, bases, &sections[i]);
+    }
+
+    // A relocatable object starts at _start when it defines one.
+    for (i = 0; eh.e_type == ELF_ET_REL && i < nsymbols; i++) {
+        if (strcmp(symbols[i].name, "_start") == 0)
+            result->entry = symbols[i].addr;
+    }
+
+    free(sections);
+    free(bases);
+    return rc;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * ASSEMBLY SOURCE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Assembles source straight into the region at base and keeps its
+ *        labels as symbols and its line table in *lines.
+ */
+static int load_asm(const Source *src, uint64_t base, LoadResult *result, int **lines) {
+    AsmResult ar;
+    int i, rc;
+
+    rc = asm_assemble(src->data, src->size, base, mem_host_ptr(base), region_room(base), &ar);
+    result->size = ar.size;
+    result->line = ar.line;
+    result->error = ar.error;
+    result->entry = base;
+    mem_mark_loaded(base, ar.size);
+
+    symbols = realloc(symbols, (nsymbols + ar.nlabels) * sizeof(Symbol));
+    for (i = 0; i < ar.nlabels; i++) {
+        if (ar.labels[i].addr == UINT64_MAX)
+            continue;
+        if (strcmp(ar.labels[i].name, "_start") == 0)
+            result->entry = ar.labels[i].addr;
+        symbols[nsymbols].addr = ar.labels[i].addr;
+        symbols[nsymbols].size = 0;
+        symbols[nsymbols++].name = ar.labels[i].name;
+        ar.labels[i].name = NULL;
+    }
+    qsort(symbols, nsymbols, sizeof(Symbol), symbol_cmp);
+    *lines = ar.lines;
+    ar.lines = NULL;
+    asm_release(&ar);
+
+    if (rc == ASM_ERR_TOO_BIG)
+        return LOADER_ERR_TOO_BIG;
+    return rc == ASM_OK ? LOADER_OK : LOADER_ERR_MALFORMED;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * PUBLIC INTERFACE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Loads a program image, ELF or hex, into guest memory.
+ */
+int load_image(const char *path, LoadResult *result) {
+    Source src;
+    int *lines = NULL, rc;
+
+    memset(result, 0, sizeof(*result));
+    result->line = 1;
+    if (source_open(path, &src) < 0)
+        return LOADER_ERR_OPEN;
+
+    size_t len = strlen(path);
+    if (src.size >= 4 && memcmp(src.data, "\x7f" "ELF", 4) == 0)
+        rc = load_elf(&src, result);
+    else if (len > 2 && path[len - 2] == '.' && (path[len - 1] == 's' || path[len - 1] == 'S'))
+        rc = load_asm(&src, MEM_TEXT_START, result, &lines);
+    else
+        rc = load_hex(&src, MEM_TEXT_START, result);
+
+    source_close(&src);
+    if (rc == LOADER_OK && result->size > 0) {
+        sources = realloc(sources, (nsources + 1) * sizeof(SourceMap));
+        sources[nsources++] = (SourceMap) { strdup(path), MEM_TEXT_START, result->size, lines };
+    } else {
+        free(lines);
+    }
+    return rc;
+}
+
+/**
+ * @brief Writes guest memory out as a hex image.
+ */
+int save_hex_image(const char *path, uint64_t base, uint64_t size) {
+    const uint8_t *p = mem_host_ptr(base);
+    uint64_t off;
+    FILE *out = fopen(path, "w");
+
+    if (out == NULL || (p == NULL && size > 0)) {
+        if (out != NULL)
+            fclose(out);
+        return LOADER_ERR_OPEN;
+    }
+    for (off = 0; off + 4 <= size; off += 4)
+        fprintf(out, "%02x%02x%02x%02x\n", p[off + 3], p[off + 2], p[off + 1], p[off]);
+    return fclose(out) == 0 ? LOADER_OK : LOADER_ERR_OPEN;
+}
+
+/**
+ * @brief Finds the nearest symbol at or below an address.
+ */
+const Symbol *symbol_lookup(uint64_t addr) {
+    int lo = 0, hi = nsymbols;
+
+    // Binary search for the first symbol above addr.
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo > 0 ? &symbols[lo - 1] : NULL;
+}
+
+/**
+ * @brief Finds the file and line an instruction was loaded from; the most
+ *        recent image wins where several cover the address.
+ */
+int source_line(uint64_t addr, const char **path) {
+    int i;
+
+    for (i = nsources - 1; i >= 0; i--) {
+        uint64_t w = (addr - sources[i].start) / 4;
+
+        if (addr < sources[i].start || w >= sources[i].size / 4)
+            continue;
+        *path = sources[i].path;
+        return sources[i].lines ? sources[i].lines[w] : (int) w + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Number of symbols kept from loaded ELF files.
+ */
+int symbol_count() {
+    return nsymbols;
+}
+
+// final version
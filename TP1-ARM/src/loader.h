@@ -0,0 +1,113 @@
+/**
+ * @file loader.h
+ * @brief Program image loaders.
+ */
+
+#ifndef LOADER_H
+#define LOADER_H
+
+#include <stdint.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * RESULT CODES
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define LOADER_OK             0
+#define LOADER_ERR_OPEN      -1   ///< File can't be opened or read (errno is set)
+#define LOADER_ERR_MALFORMED -2   ///< Bad token; the line number is reported
+#define LOADER_ERR_TOO_BIG   -3   ///< Image does not fit in the target region
+#define LOADER_ERR_FORMAT    -4   ///< ELF file for another machine or layout
+
+/**
+ * @struct LoadResult
+ * @brief Outcome of loading one program image.
+ */
+typedef struct {
+    uint64_t size;     ///< Bytes loaded into the text region
+    uint64_t data;     ///< Bytes loaded elsewhere (ELF data sections)
+    uint64_t entry;    ///< Initial PC
+    int line;          ///< Line of the first malformed token, if any
+    const char *error; ///< What was wrong with that line, if known
+    int elf;           ///< Image was an ELF file
+    int relocs;        ///< ELF relocations left unapplied
+} LoadResult;
+
+/**
+ * @struct Symbol
+ * @brief A named guest address kept from an ELF symbol table.
+ */
+typedef struct {
+    uint64_t addr, size;
+    char *name;
+} Symbol;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FUNCTION DECLARATIONS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Loads a program image into guest memory.
+ *
+ * Regular files are mmap()ed; "-", pipes and other streams are read in
+ * full first. ELF objects and executables are recognized by their magic
+ * number, assembly source by a .s or .S extension; anything else is
+ * parsed as a hex image.
+ *
+ * Hex images (one 32-bit word per line, as produced by asm2hex) go to
+ * MEM_TEXT_START. Eight-digit words, the common case, are converted eight
+ * characters at a time.
+ *
+ * ELF executables are loaded segment by segment at their virtual
+ * addresses. Relocatable objects get their executable sections placed
+ * from MEM_TEXT_START and the other allocated sections from
+ * MEM_DATA_START. In both cases the symbol table is kept.
+ *
+ * Assembly source is assembled straight into MEM_TEXT_START by the
+ * built-in assembler; its labels become symbols.
+ *
+ * @param path   File to load, or "-" for stdin.
+ * @param result Receives sizes, entry point and, on error, the line number.
+ * @return int LOADER_OK or one of the LOADER_ERR_* codes.
+ */
+int load_image(const char *path, LoadResult *result);
+
+/**
+ * @brief Writes guest memory out as a hex image, one word per line.
+ *
+ * @param path File to create.
+ * @param base First guest address.
+ * @param size Bytes to write (a multiple of 4).
+ * @return int LOADER_OK or LOADER_ERR_OPEN.
+ */
+int save_hex_image(const char *path, uint64_t base, uint64_t size);
+
+/**
+ * @brief Finds the symbol covering an address (the nearest one at or
+ *        below it).
+ *
+ * @param addr Guest address.
+ * @return const Symbol* The symbol, or NULL if none was loaded below addr.
+ */
+const Symbol *symbol_lookup(uint64_t addr);
+
+/**
+ * @brief Finds the source file and line an instruction was loaded from.
+ *
+ * Assembly sources keep the line of the statement that emitted each word.
+ * Hex images hold one word per line, so line n is the nth word; ELF text
+ * has no line information and is numbered the same way.
+ *
+ * @param addr Guest address in the text region.
+ * @param path Receives the file name as given to load_image().
+ * @return int Line number, or 0 if no loaded image covers addr.
+ */
+int source_line(uint64_t addr, const char **path);
+
+/**
+ * @brief Number of symbols kept from loaded ELF files.
+ */
+int symbol_count();
+
+#endif // LOADER_H
+
+// final version
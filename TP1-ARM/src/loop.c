@@ -0,0 +1,76 @@
+/**
+ * @file loop.c
+ * @brief Detection of guests stuck in a loop that makes no progress.
+ */
+
+#include "loop.h"
+#include "shell.h"
+#include "memory.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/**
+ * @struct LoopSlot
+ * @brief The reference sample kept for one branch target.
+ */
+typedef struct {
+    uint64_t visits;      ///< 0: slot unused
+    uint64_t epoch;       ///< mem_epoch when the reference was taken
+    uint64_t icount;      ///< Instruction count when it was taken
+    CPU_State state;      ///< Registers, flags and PC at that point
+} LoopSlot;
+
+int loop_detect;
+int loop_stopped;
+
+static LoopSlot *slots;
+static uint64_t stuck_pc, stuck_period;
+
+static void save(LoopSlot *s) {
+    s->epoch = mem_epoch;
+    s->icount = INSTRUCTION_COUNT;
+    s->state = NEXT_STATE;
+}
+
+void loop_sample() {
+    LoopSlot *s;
+
+    if (slots == NULL && (slots = calloc(LOOP_SLOTS, sizeof(LoopSlot))) == NULL) {
+        loop_detect = 0;
+        return;
+    }
+
+    s = &slots[(NEXT_STATE.PC >> 2) & (LOOP_SLOTS - 1)];
+    if (s->visits == 0 || s->state.PC != NEXT_STATE.PC) {
+        s->visits = 1;
+        save(s);
+        return;
+    }
+
+    if (s->epoch == mem_epoch && memcmp(&s->state, &NEXT_STATE, sizeof(CPU_State)) == 0) {
+        stuck_pc = NEXT_STATE.PC;
+        stuck_period = INSTRUCTION_COUNT - s->icount;
+        loop_stopped = 1;
+        RUN_BIT = 0;
+        return;
+    }
+
+    s->visits++;
+    if ((s->visits & (s->visits - 1)) == 0)
+        save(s);
+}
+
+void loop_reset() {
+    if (slots != NULL)
+        memset(slots, 0, LOOP_SLOTS * sizeof(LoopSlot));
+    loop_stopped = 0;
+}
+
+void loop_report(FILE *out) {
+    fprintf(out, "Stopped: guest stuck in a loop at PC 0x%" PRIx64
+            " (machine state repeats every %" PRIu64 " instructions)\n\n",
+            stuck_pc, stuck_period);
+}
+
+// final version
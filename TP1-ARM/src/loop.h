@@ -0,0 +1,53 @@
+/**
+ * @file loop.h
+ * @brief Detection of guests stuck in a loop that makes no progress.
+ *
+ * The machine is deterministic, so if registers, flags, PC and memory are
+ * ever exactly the same at two points of a run, it will repeat forever.
+ * Samples are taken at backward branches only: the register file is
+ * compared word for word with an earlier sample at the same PC, and
+ * memory is summarized by mem_epoch.
+ */
+
+#ifndef LOOP_H
+#define LOOP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define LOOP_SLOTS 4096   ///< Branch targets tracked at once (direct-mapped)
+
+/**
+ * @brief Enables sampling. Checked by the core before calling loop_sample().
+ */
+extern int loop_detect;
+
+/**
+ * @brief Set when a repeat cleared RUN_BIT, so the run loop can tell it
+ *        from a real halt.
+ */
+extern int loop_stopped;
+
+/**
+ * @brief Records the state after a backward branch and stops the machine if
+ *        it repeats an earlier sample at the same PC.
+ *
+ * A slot keeps the state of its branch target from the last power-of-two
+ * visit (Brent's cycle detection), so a loop whose state cycles with a
+ * period of p iterations is caught within about 2p iterations.
+ */
+void loop_sample();
+
+/**
+ * @brief Forgets every sample (after reset or a register change).
+ */
+void loop_reset();
+
+/**
+ * @brief Describes the repeat that set loop_stopped.
+ */
+void loop_report(FILE *out);
+
+#endif // LOOP_H
+
+// final version
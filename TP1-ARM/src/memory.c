@@ -0,0 +1,444 @@
+/**
+ * @file memory.c
+ * @brief Guest memory layer: region table, word access and dirty-page tracking.
+ */
+
+#include "memory.h"
+#include "shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REGION TABLE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/* memory will be dynamically allocated at initialization */
+mem_region_t MEM_REGIONS[MEM_MAX_REGIONS] = {
+    { MEM_TEXT_START, MEM_TEXT_SIZE, NULL, NULL, 0, -1, NULL, 0 },
+    { MEM_DATA_START, MEM_DATA_SIZE, NULL, NULL, 0, -1, NULL, 0 },
+    { MEM_STACK_START, MEM_STACK_SIZE, NULL, NULL, 0, -1, NULL, 0 },
+};
+
+int MEM_NREGIONS = 3;
+
+uint64_t mem_epoch;
+
+static mem_device_t devices[MEM_MAX_DEVICES];
+static int ndevices;
+
+
+/**
+ * @brief Number of guest pages covering a region.
+ */
+static uint64_t region_pages(const mem_region_t *r) {
+    return (r->size + MEM_PAGE_SIZE - 1) >> MEM_PAGE_SHIFT;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * WORD ACCESS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Reads a 32-bit little-endian word from guest memory.
+ *
+ * @param address Guest address.
+ * @return uint32_t Word at address, the device register value, or 0 if unmapped.
+ */
+uint32_t mem_read_32(uint64_t address)
+{
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= MEM_REGIONS[i].start &&
+                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
+            uint32_t offset = address - MEM_REGIONS[i].start;
+
+            return
+                (MEM_REGIONS[i].mem[offset+3] << 24) |
+                (MEM_REGIONS[i].mem[offset+2] << 16) |
+                (MEM_REGIONS[i].mem[offset+1] <<  8) |
+                (MEM_REGIONS[i].mem[offset+0] <<  0);
+        }
+    }
+
+    for (i = 0; i < ndevices; i++) {
+        if (address >= devices[i].start &&
+                address < (devices[i].start + devices[i].size)) {
+            if (!devices[i].read)
+                return 0;
+            mem_epoch++;
+            return devices[i].read(devices[i].ctx, address - devices[i].start);
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Writes a 32-bit little-endian word to guest memory and marks the
+ *        touched page(s) dirty. Device ranges go to their write callback;
+ *        writes to unmapped addresses are dropped.
+ *
+ * @param address Guest address.
+ * @param value   Word to store.
+ */
+void mem_write_32(uint64_t address, uint32_t value)
+{
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= MEM_REGIONS[i].start &&
+                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
+            uint32_t offset = address - MEM_REGIONS[i].start;
+            uint32_t old =
+                (MEM_REGIONS[i].mem[offset+3] << 24) |
+                (MEM_REGIONS[i].mem[offset+2] << 16) |
+                (MEM_REGIONS[i].mem[offset+1] <<  8) |
+                (MEM_REGIONS[i].mem[offset+0] <<  0);
+
+            mem_epoch += old != value;
+            MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
+            MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
+            MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
+            MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
+
+            // An unaligned word may straddle two pages; the map has a spare
+            // slot so the last page never indexes past the end.
+            MEM_REGIONS[i].dirty[offset >> MEM_PAGE_SHIFT] = MEM_DIRTY_ALL;
+            MEM_REGIONS[i].dirty[(offset + 3) >> MEM_PAGE_SHIFT] = MEM_DIRTY_ALL;
+            return;
+        }
+    }
+
+    for (i = 0; i < ndevices; i++) {
+        if (address >= devices[i].start &&
+                address < (devices[i].start + devices[i].size)) {
+            mem_epoch++;
+            if (devices[i].write)
+                devices[i].write(devices[i].ctx, address - devices[i].start, value);
+            return;
+        }
+    }
+}
+
+/**
+ * @brief Routes a guest address range to device callbacks.
+ */
+int mem_register_device(uint64_t start, uint64_t size, mem_dev_read_fn read,
+                        mem_dev_write_fn write, void *ctx) {
+    int i;
+
+    if (ndevices == MEM_MAX_DEVICES || size == 0)
+        return -1;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (start < MEM_REGIONS[i].start + MEM_REGIONS[i].size &&
+                MEM_REGIONS[i].start < start + size)
+            return -1;
+    }
+    for (i = 0; i < ndevices; i++) {
+        if (start < devices[i].start + devices[i].size &&
+                devices[i].start < start + size)
+            return -1;
+    }
+
+    devices[ndevices++] = (mem_device_t) { start, size, read, write, ctx };
+    return 0;
+}
+
+/**
+ * @brief Translates a guest address to its host location.
+ *
+ * @param address Guest address.
+ * @return uint8_t* Host pointer, or NULL if the address is unmapped.
+ */
+uint8_t *mem_host_ptr(uint64_t address) {
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (address >= MEM_REGIONS[i].start &&
+                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size))
+            return MEM_REGIONS[i].mem + (address - MEM_REGIONS[i].start);
+    }
+    return NULL;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * INITIALIZATION AND RESET
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Maps every memory region and allocates its dirty map.
+ *
+ * Regions are anonymous mappings: page-aligned, so they can be protected
+ * for watchpoints, and zero-filled by the kernel on first touch.
+ */
+void init_memory() {
+    int i;
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        // Extra 3 bytes to prevent buffer overflow on unaligned access.
+        MEM_REGIONS[i].mem = mmap(NULL, MEM_REGIONS[i].size + 3,
+                                  PROT_READ | PROT_WRITE,
+                                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (MEM_REGIONS[i].mem == MAP_FAILED) {
+            printf("Error: Can't map memory region at 0x%" PRIx64 "\n",
+                   MEM_REGIONS[i].start);
+            exit(-1);
+        }
+        MEM_REGIONS[i].dirty = calloc(region_pages(&MEM_REGIONS[i]) + 1, 1);
+    }
+}
+
+/**
+ * @brief Whether [start, start + size) may be mapped: it may cover the data
+ *        region, but no other region and no device.
+ */
+static int map_fits(uint64_t start, uint64_t size) {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        const mem_region_t *r = &MEM_REGIONS[i];
+        if (r->start != MEM_DATA_START && start < r->start + r->size && r->start < start + size)
+            return 0;
+    }
+    for (i = 0; i < ndevices; i++) {
+        if (start < devices[i].start + devices[i].size && devices[i].start < start + size)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Maps a host file straight into guest memory at the given address.
+ *
+ * An anonymous reservation one page larger than the file is made first and
+ * the file is mapped over it, so the unaligned-access slack past the end of
+ * the file is always backed.
+ */
+int mem_map_file(const char *path, uint64_t start, int writable) {
+    struct stat st;
+    uint8_t *mem;
+    long page = sysconf(_SC_PAGESIZE);
+    int fd;
+
+    if (MEM_NREGIONS == MEM_MAX_REGIONS) {
+        errno = ENOSPC;
+        return -1;
+    }
+    if (start & (MEM_PAGE_SIZE - 1)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0 || !map_fits(start, st.st_size)) {
+        close(fd);
+        errno = st.st_size == 0 ? EINVAL : EEXIST;
+        return -1;
+    }
+
+    uint64_t size = st.st_size;
+    uint64_t span = (size + 3 + page - 1) & ~(uint64_t) (page - 1);
+
+    mem = mmap(NULL, span, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    if (mmap(mem, size, PROT_READ | PROT_WRITE,
+             MAP_FIXED | (writable ? MAP_SHARED : MAP_PRIVATE), fd, 0) == MAP_FAILED) {
+        int saved = errno;
+        munmap(mem, span);
+        close(fd);
+        errno = saved;
+        return -1;
+    }
+
+    // Newest mapping first, so it shadows the data region if it overlaps it;
+    // mem_text_region() finds the text wherever it ends up.
+    memmove(&MEM_REGIONS[1], &MEM_REGIONS[0], MEM_NREGIONS * sizeof(mem_region_t));
+    MEM_REGIONS[0] = (mem_region_t) {
+        start, size, mem, NULL,
+        MEM_REGION_FILE | (writable ? MEM_REGION_SHARED : 0), fd, NULL, 0
+    };
+    MEM_REGIONS[0].dirty = calloc(region_pages(&MEM_REGIONS[0]) + 1, 1);
+    MEM_NREGIONS++;
+    return 0;
+}
+
+/**
+ * @brief The region holding MEM_TEXT_START.
+ */
+mem_region_t *mem_text_region() {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        if (MEM_REGIONS[i].start == MEM_TEXT_START)
+            return &MEM_REGIONS[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief Flags a range written directly by a loader.
+ */
+void mem_mark_loaded(uint64_t start, uint64_t size) {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS && size > 0; i++) {
+        mem_region_t *r = &MEM_REGIONS[i];
+        if (start < r->start || start >= r->start + r->size)
+            continue;
+
+        uint64_t off = start - r->start;
+        uint64_t end = off + size < r->size ? off + size : r->size;
+        for (uint64_t p = off >> MEM_PAGE_SHIFT; p << MEM_PAGE_SHIFT < end; p++)
+            r->dirty[p] |= MEM_DIRTY_RESET;
+        return;
+    }
+}
+
+/**
+ * @brief Records every loaded page as the reset baseline and marks every
+ *        page clean.
+ *
+ * The image of a region spans up to its last loaded page; later pages are
+ * simply zeroed on reset.
+ */
+void mem_set_baseline() {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *r = &MEM_REGIONS[i];
+        uint64_t npages = region_pages(r);
+        uint64_t p = npages;
+
+        free(r->image);
+        r->image = NULL;
+        r->image_size = 0;
+
+        if (!(r->flags & MEM_REGION_FILE)) {
+            while (p > 0 && !(r->dirty[p - 1] & MEM_DIRTY_ALL))
+                p--;
+            r->image_size = p << MEM_PAGE_SHIFT;
+            if (r->image_size > r->size)
+                r->image_size = r->size;
+            if (r->image_size > 0) {
+                r->image = malloc(r->image_size);
+                memcpy(r->image, r->mem, r->image_size);
+            }
+        }
+
+        memset(r->dirty, 0, npages + 1);
+    }
+}
+
+/**
+ * @brief Zeroes every page written since the last reset, then copies the
+ *        baseline image or the backing file contents back over it.
+ */
+int mem_reset() {
+    int i, restored = 0;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *r = &MEM_REGIONS[i];
+        uint64_t npages = region_pages(r);
+        uint64_t p;
+
+        for (p = 0; p < npages; p++) {
+            if (!(r->dirty[p] & MEM_DIRTY_RESET))
+                continue;
+            if (r->flags & MEM_REGION_SHARED) {
+                r->dirty[p] &= ~MEM_DIRTY_RESET;  // results belong to the file
+                continue;
+            }
+
+            uint64_t off = p << MEM_PAGE_SHIFT;
+            uint64_t len = MEM_PAGE_SIZE;
+            if (off + len >= r->size) {
+                len = r->size - off;
+                memset(r->mem + r->size, 0, 3);  // unaligned-access slack
+            }
+
+            memset(r->mem + off, 0, len);
+            if (r->flags & MEM_REGION_FILE) {
+                if (pread(r->fd, r->mem + off, len, off) < 0)
+                    continue;
+            } else if (off < r->image_size) {
+                uint64_t n = r->image_size - off;
+                memcpy(r->mem + off, r->image + off, n < len ? n : len);
+            }
+
+            // The page changed again, so incremental dumps must still see it.
+            r->dirty[p] = (r->dirty[p] & ~MEM_DIRTY_RESET) | MEM_DIRTY_DUMP | MEM_DIRTY_SNAP;
+            restored++;
+        }
+        r->dirty[npages] = 0;
+    }
+
+    if (restored)
+        mem_epoch++;
+    return restored;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * DIRTY-PAGE ITERATION
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Clears a dirty flag on every page of every region.
+ */
+void mem_clear_dirty(uint8_t flag) {
+    int i;
+    uint64_t p;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        for (p = 0; p <= region_pages(&MEM_REGIONS[i]); p++)
+            MEM_REGIONS[i].dirty[p] &= ~flag;
+    }
+}
+
+/**
+ * @brief Walks runs of consecutive pages carrying the given dirty flag.
+ */
+void mem_for_each_dirty(uint8_t flag, int clear, mem_range_fn fn, void *ctx) {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        mem_region_t *r = &MEM_REGIONS[i];
+        uint64_t npages = region_pages(r);
+        uint64_t p = 0;
+
+        while (p < npages) {
+            if (!(r->dirty[p] & flag)) {
+                p++;
+                continue;
+            }
+
+            uint64_t first = p;
+            while (p < npages && (r->dirty[p] & flag)) {
+                if (clear)
+                    r->dirty[p] &= ~flag;
+                p++;
+            }
+
+            uint64_t off = first << MEM_PAGE_SHIFT;
+            uint64_t end = p << MEM_PAGE_SHIFT;
+            if (end > r->size)
+                end = r->size;
+            fn(r->start + off, end - off, ctx);
+        }
+    }
+}
+
+// final version
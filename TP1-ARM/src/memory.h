@@ -0,0 +1,201 @@
+/**
+ * @file memory.h
+ * @brief Guest memory layer: region table, word access and dirty-page tracking.
+ */
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * MEMORY MAP
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define MEM_DATA_START  0x10000000
+#define MEM_DATA_SIZE   0x00100000
+#define MEM_TEXT_START  0x00400000
+#define MEM_TEXT_SIZE   0x00100000
+#define MEM_STACK_START 0xfffffffc
+#define MEM_STACK_SIZE  0x00100000
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * DIRTY-PAGE TRACKING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define MEM_PAGE_SHIFT 12                     ///< Guest pages are 4 KB
+#define MEM_PAGE_SIZE  (1u << MEM_PAGE_SHIFT)
+
+#define MEM_DIRTY_RESET 0x1  ///< Page written since the last reset
+#define MEM_DIRTY_DUMP  0x2  ///< Page written since the last incremental dump
+#define MEM_DIRTY_SNAP  0x4  ///< Page written since the last snapshot
+#define MEM_DIRTY_ALL   (MEM_DIRTY_RESET | MEM_DIRTY_DUMP | MEM_DIRTY_SNAP)
+
+#define MEM_MAX_REGIONS 16
+
+#define MEM_REGION_FILE   0x1  ///< Backed by a host file rather than anonymous memory
+#define MEM_REGION_SHARED 0x2  ///< Guest stores reach the file (MAP_SHARED)
+
+/**
+ * @struct mem_region_t
+ * @brief A contiguous guest memory region backed by a host buffer.
+ */
+typedef struct {
+    uint64_t start, size;
+    uint8_t *mem;
+    uint8_t *dirty;          ///< One MEM_DIRTY_* flag byte per guest page
+    int flags;               ///< MEM_REGION_* bits
+    int fd;                  ///< Backing file, or -1
+    uint8_t *image;          ///< Contents restored by reset (loaded pages)
+    uint64_t image_size;     ///< Bytes in image
+} mem_region_t;
+
+extern mem_region_t MEM_REGIONS[MEM_MAX_REGIONS];
+extern int MEM_NREGIONS;
+
+/**
+ * @brief Bumped by every store that changes a word and by every device
+ *        access, so an unchanged value means guest memory is unchanged.
+ */
+extern uint64_t mem_epoch;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * MEMORY-MAPPED DEVICES
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+#define MEM_MAX_DEVICES 8
+
+/**
+ * @brief Device register read: returns the word at offset from the device base.
+ */
+typedef uint32_t (*mem_dev_read_fn)(void *ctx, uint64_t offset);
+
+/**
+ * @brief Device register write: receives the word stored at offset.
+ */
+typedef void (*mem_dev_write_fn)(void *ctx, uint64_t offset, uint32_t value);
+
+/**
+ * @struct mem_device_t
+ * @brief An address range whose accesses are routed to callbacks.
+ */
+typedef struct {
+    uint64_t start, size;
+    mem_dev_read_fn read;    ///< May be NULL: reads return 0
+    mem_dev_write_fn write;  ///< May be NULL: writes are dropped
+    void *ctx;
+} mem_device_t;
+
+/**
+ * @brief Callback invoked for each run of consecutive dirty pages.
+ *
+ * @param start First guest address of the run.
+ * @param size  Length of the run in bytes.
+ * @param ctx   Caller context.
+ */
+typedef void (*mem_range_fn)(uint64_t start, uint64_t size, void *ctx);
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FUNCTION DECLARATIONS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Maps every memory region and allocates its dirty map.
+ */
+void init_memory();
+
+/**
+ * @brief Routes a guest address range to device callbacks.
+ *
+ * Devices are only consulted after the RAM region lookup misses, so they
+ * add nothing to ordinary memory accesses. The range must not overlap RAM.
+ *
+ * @param start Base guest address.
+ * @param size  Range length in bytes.
+ * @param read  Register read callback.
+ * @param write Register write callback.
+ * @param ctx   Passed through to the callbacks.
+ * @return int 0 on success, -1 if the table is full or the range overlaps.
+ */
+int mem_register_device(uint64_t start, uint64_t size, mem_dev_read_fn read,
+                        mem_dev_write_fn write, void *ctx);
+
+/**
+ * @brief Translates a guest address to its host location.
+ *
+ * @param address Guest address.
+ * @return uint8_t* Host pointer, or NULL if the address is unmapped.
+ */
+uint8_t *mem_host_ptr(uint64_t address);
+
+/**
+ * @brief Maps a host file straight into guest memory at the given address.
+ *
+ * Read-only mappings are private, so guest stores stay in the simulator.
+ * Writable mappings are shared and guest stores land in the file. The start
+ * must be page aligned. The file may cover the data region, and then takes
+ * precedence over it, but not the text, the stack, another file or a device.
+ *
+ * The new region is inserted at the front of MEM_REGIONS, so indexes into
+ * the table change: use mem_text_region() rather than a fixed index.
+ *
+ * @param path     Host file to map.
+ * @param start    Guest base address.
+ * @param writable Map with MAP_SHARED so results reach the file.
+ * @return int 0 on success, -1 on error (errno is set: EINVAL for an
+ *         unaligned start or an empty file, EEXIST for an overlap).
+ */
+int mem_map_file(const char *path, uint64_t start, int writable);
+
+/**
+ * @brief The text region, wherever mapped files have moved it in the table.
+ *
+ * @return mem_region_t* The region starting at MEM_TEXT_START.
+ */
+mem_region_t *mem_text_region();
+
+/**
+ * @brief Flags a range written directly by a loader, so the next
+ *        mem_set_baseline() includes it in the reset image.
+ *
+ * @param start First guest address.
+ * @param size  Length in bytes.
+ */
+void mem_mark_loaded(uint64_t start, uint64_t size);
+
+/**
+ * @brief Records every loaded page as the reset baseline and marks every
+ *        page clean.
+ */
+void mem_set_baseline();
+
+/**
+ * @brief Restores memory to the baseline, touching only pages written
+ *        since the last reset: pages are zeroed, then the loaded image and
+ *        private file contents reloaded. Shared file regions are left as
+ *        written.
+ *
+ * @return Number of pages restored.
+ */
+int mem_reset();
+
+/**
+ * @brief Clears a dirty flag on every page of every region.
+ *
+ * @param flag One of the MEM_DIRTY_* flags.
+ */
+void mem_clear_dirty(uint8_t flag);
+
+/**
+ * @brief Walks runs of pages carrying the given dirty flag.
+ *
+ * @param flag  One of the MEM_DIRTY_* flags.
+ * @param clear Clear the flag on visited pages when non-zero.
+ * @param fn    Callback receiving each run.
+ * @param ctx   Passed through to the callback.
+ */
+void mem_for_each_dirty(uint8_t flag, int clear, mem_range_fn fn, void *ctx);
+
+#endif // MEMORY_H
+
+// final version
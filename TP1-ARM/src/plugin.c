@@ -0,0 +1,208 @@
+/**
+ * @file plugin.c
+ * @brief Instrumentation plugins loaded with dlopen.
+ */
+
+#include "plugin.h"
+#include "shell.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+/**
+ * @struct Subscribers
+ * @brief Everything registered for one event.
+ */
+typedef struct {
+    plugin_cb fn[PLUGIN_SUBSCRIBERS];
+    void *data[PLUGIN_SUBSCRIBERS];
+    int ncallbacks;
+    uint64_t *counter[PLUGIN_SUBSCRIBERS];
+    int ncounters;
+} Subscribers;
+
+/**
+ * @struct ExitHandler
+ * @brief A plugin function to run when the simulator exits.
+ */
+typedef struct {
+    void (*fn)(void *data);
+    void *data;
+} ExitHandler;
+
+unsigned plugin_mask;
+uint64_t *plugin_retire_counters[PLUGIN_SUBSCRIBERS];
+int plugin_retire_ncounters;
+
+static Subscribers events[PLUGIN_EVENTS];
+static ExitHandler exits[PLUGIN_SUBSCRIBERS];
+static int nexits, nplugins;
+static int in_block;   ///< A block has been raised and not yet ended
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * API HANDED TO PLUGINS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int api_subscribe(PluginEvent event, plugin_cb fn, void *data) {
+    Subscribers *s;
+
+    if ((unsigned) event >= PLUGIN_EVENTS || fn == NULL)
+        return -1;
+    s = &events[event];
+    if (s->ncallbacks == PLUGIN_SUBSCRIBERS)
+        return -1;
+    s->fn[s->ncallbacks] = fn;
+    s->data[s->ncallbacks++] = data;
+    plugin_mask |= 1u << event;
+    return 0;
+}
+
+static int api_inline_counter(PluginEvent event, uint64_t *counter) {
+    Subscribers *s;
+
+    if ((unsigned) event >= PLUGIN_EVENTS || counter == NULL)
+        return -1;
+    if (event == PLUGIN_RETIRE) {
+        if (plugin_retire_ncounters == PLUGIN_SUBSCRIBERS)
+            return -1;
+        plugin_retire_counters[plugin_retire_ncounters++] = counter;
+        return 0;
+    }
+    s = &events[event];
+    if (s->ncounters == PLUGIN_SUBSCRIBERS)
+        return -1;
+    s->counter[s->ncounters++] = counter;
+    plugin_mask |= 1u << event;
+    return 0;
+}
+
+static void run_exit_handlers() {
+    int i;
+
+    for (i = 0; i < nexits; i++)
+        exits[i].fn(exits[i].data);
+}
+
+static int api_at_exit(void (*fn)(void *data), void *data) {
+    if (fn == NULL || nexits == PLUGIN_SUBSCRIBERS)
+        return -1;
+    if (nexits == 0)
+        atexit(run_exit_handlers);
+    exits[nexits++] = (ExitHandler) { fn, data };
+    return 0;
+}
+
+static const PluginApi API = {
+    PLUGIN_API_VERSION, api_subscribe, api_inline_counter, api_at_exit
+};
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * LOADING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Drops everything a plugin registered before its install failed,
+ *        so nothing points into it once it is closed.
+ */
+static void forget(int nevent[PLUGIN_EVENTS][2], int nretire, int nexit, unsigned mask) {
+    int e;
+
+    for (e = 0; e < PLUGIN_EVENTS; e++) {
+        events[e].ncallbacks = nevent[e][0];
+        events[e].ncounters = nevent[e][1];
+    }
+    plugin_retire_ncounters = nretire;
+    nexits = nexit;
+    plugin_mask = mask;
+}
+
+int plugin_load(const char *spec) {
+    char *path = strdup(spec), *comma = strchr(path, ',');
+    const char *args = "";
+    plugin_install_fn install;
+    void *handle;
+    int nevent[PLUGIN_EVENTS][2], nretire = plugin_retire_ncounters, nexit = nexits, e;
+    unsigned mask = plugin_mask;
+
+    if (comma != NULL) {
+        *comma = '\0';
+        args = comma + 1;
+    }
+    if (nplugins == PLUGIN_MAX) {
+        fprintf(stderr, "Can't load %s: at most %d plugins\n", path, PLUGIN_MAX);
+        free(path);
+        return -1;
+    }
+    if ((handle = dlopen(path, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+        fprintf(stderr, "Can't load plugin: %s\n", dlerror());
+        free(path);
+        return -1;
+    }
+    // POSIX leaves object-to-function pointer conversion to dlsym itself.
+    *(void **) &install = dlsym(handle, "sim_plugin_install");
+    if (install == NULL) {
+        fprintf(stderr, "Plugin %s has no sim_plugin_install\n", path);
+        dlclose(handle);
+        free(path);
+        return -1;
+    }
+    for (e = 0; e < PLUGIN_EVENTS; e++) {
+        nevent[e][0] = events[e].ncallbacks;
+        nevent[e][1] = events[e].ncounters;
+    }
+    if (install(&API, args) != 0) {
+        fprintf(stderr, "Plugin %s failed to install\n", path);
+        forget(nevent, nretire, nexit, mask);
+        dlclose(handle);
+        free(path);
+        return -1;
+    }
+    // args points into path and stays valid for the plugin's lifetime.
+    nplugins++;
+    return 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * EVENTS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void raise_event(PluginEvent event, const PluginInfo *info) {
+    Subscribers *s = &events[event];
+    int i;
+
+    for (i = 0; i < s->ncounters; i++)
+        (*s->counter[i])++;
+    for (i = 0; i < s->ncallbacks; i++)
+        s->fn[i](s->data[i], info);
+}
+
+void plugin_retire(const Instruction *inst, uint32_t raw, uint64_t pc, uint64_t next) {
+    PluginInfo info = { pc, raw, inst->valid ? inst->name : NULL, 0, 0, 0 };
+
+    if (plugin_mask & (1u << PLUGIN_BLOCK)) {
+        if (!in_block)
+            raise_event(PLUGIN_BLOCK, &info);
+        in_block = next == pc + 4 && !inst_ends_block(inst);
+    }
+
+    if (plugin_mask & (1u << PLUGIN_RETIRE))
+        raise_event(PLUGIN_RETIRE, &info);
+
+    if ((plugin_mask & (1u << PLUGIN_MEM)) && inst->valid
+            && (strncmp(inst->name, "LDUR", 4) == 0 || strncmp(inst->name, "STUR", 4) == 0)) {
+        info.addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
+        info.size = inst->name[4] == 'B' ? 1 : inst->name[4] == 'H' ? 2 : 8;
+        info.write = inst->name[0] == 'S';
+        raise_event(PLUGIN_MEM, &info);
+    }
+
+    if ((plugin_mask & (1u << PLUGIN_BRANCH)) && next != pc + 4) {
+        info.addr = next;
+        info.size = 0;
+        info.write = 0;
+        raise_event(PLUGIN_BRANCH, &info);
+    }
+}
+
+// final version
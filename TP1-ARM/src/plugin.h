@@ -0,0 +1,120 @@
+/**
+ * @file plugin.h
+ * @brief Instrumentation plugins loaded with dlopen.
+ *
+ * A plugin is a shared object that exports
+ *
+ *     int sim_plugin_install(const PluginApi *api, const char *args);
+ *
+ * It is called once at startup, with whatever followed the first ',' of
+ * the --plugin argument; that string is never freed. It subscribes to the events it wants and returns
+ * 0; anything else stops the simulator before it starts. The engine only calls
+ * subscribers that are registered, and with no subscriptions at all the
+ * simulator pays one test per instruction. See plugins/ for an example.
+ *
+ * For pure counting, a plugin registers an inline counter instead of a
+ * callback. The engine then increments the plugin's uint64_t itself on
+ * every event, with no call; PLUGIN_RETIRE counters are bumped by the
+ * INSTR_EXECUTE hook, so counting instructions doesn't even reach
+ * plugin_retire().
+ *
+ * Build a plugin with: gcc -shared -fPIC -I<src> -o tool.so tool.c
+ */
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include "decoder.h"
+#include <stdint.h>
+
+#define PLUGIN_API_VERSION 1
+#define PLUGIN_MAX 16            ///< Plugins loaded at once
+#define PLUGIN_SUBSCRIBERS 32    ///< Callbacks or counters per event
+
+/**
+ * @brief Events a plugin can subscribe to.
+ */
+typedef enum {
+    PLUGIN_BLOCK,     ///< First instruction after a control transfer (or of the run)
+    PLUGIN_RETIRE,    ///< Any instruction, including undecodable ones
+    PLUGIN_MEM,       ///< A load or store, with its address and size
+    PLUGIN_BRANCH,    ///< An instruction that did not continue at pc + 4
+    PLUGIN_EVENTS
+} PluginEvent;
+
+/**
+ * @struct PluginInfo
+ * @brief What a callback is told about the event.
+ */
+typedef struct {
+    uint64_t pc;       ///< Address of the instruction
+    uint32_t raw;      ///< Its encoding
+    const char *name;  ///< Decoder name (e.g. "ADDS_IMM"), or NULL if undecodable
+    uint64_t addr;     ///< PLUGIN_MEM: guest address; PLUGIN_BRANCH: target
+    unsigned size;     ///< PLUGIN_MEM: bytes accessed
+    int write;         ///< PLUGIN_MEM: 1 for a store
+} PluginInfo;
+
+typedef void (*plugin_cb)(void *data, const PluginInfo *info);
+
+/**
+ * @struct PluginApi
+ * @brief Functions the simulator hands to sim_plugin_install().
+ */
+typedef struct {
+    int version;   ///< PLUGIN_API_VERSION
+
+    /** Calls fn(data, info) on every event; returns 0, or -1 if full. */
+    int (*subscribe)(PluginEvent event, plugin_cb fn, void *data);
+
+    /** Adds one to *counter on every event; returns 0, or -1 if full. */
+    int (*inline_counter)(PluginEvent event, uint64_t *counter);
+
+    /** Calls fn(data) when the simulator exits, to report or save results. */
+    int (*at_exit)(void (*fn)(void *data), void *data);
+} PluginApi;
+
+/**
+ * @brief Signature of the function every plugin exports.
+ */
+typedef int (*plugin_install_fn)(const PluginApi *api, const char *args);
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * SIMULATOR SIDE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Bit (1 << event) is set while the event has any subscriber.
+ *        Checked by process_instruction() before calling plugin_retire().
+ */
+extern unsigned plugin_mask;
+
+/**
+ * @brief Inline counters of PLUGIN_RETIRE, bumped by INSTR_EXECUTE after
+ *        plugin_retire(). They don't set a bit in plugin_mask.
+ */
+extern uint64_t *plugin_retire_counters[PLUGIN_SUBSCRIBERS];
+extern int plugin_retire_ncounters;
+
+/**
+ * @brief Loads "path[,args]" and runs its sim_plugin_install().
+ *
+ * @return int 0 on success, -1 with the reason printed on stderr.
+ */
+int plugin_load(const char *spec);
+
+/**
+ * @brief Raises the events of one executed instruction. Called before
+ *        CURRENT_STATE is updated, so base registers hold the values the
+ *        access used.
+ *
+ * @param inst Decoded instruction (valid is 0 if it didn't decode).
+ * @param raw  Its encoding.
+ * @param pc   Address it was fetched from.
+ * @param next Address of the next instruction.
+ */
+void plugin_retire(const Instruction *inst, uint32_t raw, uint64_t pc, uint64_t next);
+
+#endif // PLUGIN_H
+
+// final version
@@ -0,0 +1,54 @@
+/**
+ * @file insn_count.c
+ * @brief Example plugin: counts events with inline counters and sizes the
+ *        guest's loads and stores with a callback.
+ *
+ * Build with "make plugins" and run with
+ *
+ *     ./sim --plugin plugins/insn_count.so[,out-file] program.x
+ *
+ * The counts are printed on stderr, or written to out-file, at exit.
+ */
+
+#include "plugin.h"
+#include <stdio.h>
+#include <inttypes.h>
+
+static uint64_t blocks, retired, accesses, branches;
+static uint64_t bytes_read, bytes_written;
+static const char *out_path;
+
+static void on_mem(void *data, const PluginInfo *info) {
+    (void) data;
+    if (info->write)
+        bytes_written += info->size;
+    else
+        bytes_read += info->size;
+}
+
+static void report(void *data) {
+    FILE *out = out_path[0] ? fopen(out_path, "w") : stderr;
+    (void) data;
+
+    if (out == NULL)
+        return;
+    fprintf(out, "blocks %" PRIu64 "\ninstructions %" PRIu64 "\nbranches %" PRIu64 "\n"
+            "memory accesses %" PRIu64 " (%" PRIu64 " bytes read, %" PRIu64 " written)\n",
+            blocks, retired, branches, accesses, bytes_read, bytes_written);
+    if (out != stderr)
+        fclose(out);
+}
+
+int sim_plugin_install(const PluginApi *api, const char *args) {
+    if (api->version != PLUGIN_API_VERSION)
+        return -1;
+    out_path = args;
+    api->inline_counter(PLUGIN_BLOCK, &blocks);
+    api->inline_counter(PLUGIN_RETIRE, &retired);
+    api->inline_counter(PLUGIN_BRANCH, &branches);
+    api->inline_counter(PLUGIN_MEM, &accesses);
+    api->subscribe(PLUGIN_MEM, on_mem, NULL);
+    return api->at_exit(report, NULL);
+}
+
+// final version
@@ -0,0 +1,26 @@
+/**
+ * @file pmu.c
+ * @brief Counters the guest can read with MRS.
+ */
+
+#include "pmu.h"
+#include "shell.h"
+
+uint64_t pmu_stalls;
+
+uint64_t pmu_read(uint32_t raw) {
+    switch (raw & ~0x1Fu) {
+    case PMU_PMCCNTR_EL0:
+        return INSTRUCTION_COUNT + pmu_stalls;
+    case PMU_CNTVCT_EL0:
+        return INSTRUCTION_COUNT;
+    default:
+        return 0;
+    }
+}
+
+void pmu_reset() {
+    pmu_stalls = 0;
+}
+
+// final version
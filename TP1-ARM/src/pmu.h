@@ -0,0 +1,43 @@
+/**
+ * @file pmu.h
+ * @brief Counters the guest can read with MRS.
+ *
+ * CNTVCT_EL0 ticks once per retired instruction. PMCCNTR_EL0 counts modeled
+ * cycles: one per instruction, plus the stalls below, which execute()
+ * charges as it runs the instructions concerned. Both read the count
+ * before the MRS itself retires, and both restart at zero on reset.
+ * Other system registers don't decode and trap as unknown instructions.
+ */
+
+#ifndef PMU_H
+#define PMU_H
+
+#include <stdint.h>
+
+#define PMU_PMCCNTR_EL0 0xD53B9D00   ///< mrs x0, pmccntr_el0
+#define PMU_CNTVCT_EL0  0xD53BE040   ///< mrs x0, cntvct_el0
+
+#define PMU_MUL_STALL    2   ///< Extra cycles of a multiply
+#define PMU_LOAD_STALL   3   ///< Extra cycles of a load
+#define PMU_BRANCH_STALL 2   ///< Extra cycles of a taken branch
+
+/**
+ * @brief Stall cycles charged since the last reset.
+ */
+extern uint64_t pmu_stalls;
+
+/**
+ * @brief Value of the register an MRS reads.
+ *
+ * @param raw The MRS word; Rt is ignored.
+ */
+uint64_t pmu_read(uint32_t raw);
+
+/**
+ * @brief Clears the modeled cycles.
+ */
+void pmu_reset();
+
+#endif // PMU_H
+
+// final version
@@ -0,0 +1,219 @@
+/**
+ * @file profile.c
+ * @brief Guest execution profiler: exact per-PC counts over the text region.
+ */
+
+#include "profile.h"
+#include "shell.h"
+#include "memory.h"
+#include "decoder.h"
+#include "loader.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/**
+ * @struct Block
+ * @brief A straight-line run of instructions executed the same number of times.
+ */
+typedef struct {
+    uint64_t start;       ///< Word index of the first instruction
+    uint64_t len;         ///< Instructions in the block
+    uint64_t execs;       ///< Times the block was entered
+    uint64_t insns;       ///< Instructions retired in it
+} Block;
+
+/**
+ * @struct Tally
+ * @brief Executions attributed to one opcode class or one branch.
+ */
+typedef struct {
+    char name[16];
+    uint64_t pc;
+    uint64_t count, taken;
+} Tally;
+
+int profiling;
+
+static uint64_t *executed, *taken;   ///< One counter per text word
+static uint64_t base, size, outside;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * COUNTING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int profile_start() {
+    if (executed == NULL) {
+        base = mem_text_region()->start;
+        size = mem_text_region()->size & ~3ull;
+        executed = calloc(size / 4, sizeof(uint64_t));
+        taken = calloc(size / 4, sizeof(uint64_t));
+        if (executed == NULL || taken == NULL) {
+            free(executed);
+            free(taken);
+            executed = taken = NULL;
+            return -1;
+        }
+    }
+    profiling = 1;
+    return 0;
+}
+
+void profile_retire(uint64_t pc, uint64_t next) {
+    uint64_t off = pc - base;
+
+    // Misaligned PCs would alias a neighbouring word; keep them apart.
+    if (off < size && (off & 3) == 0) {
+        executed[off >> 2]++;
+        taken[off >> 2] += next != pc + 4;
+    } else {
+        outside++;
+    }
+}
+
+void profile_reset() {
+    if (executed != NULL) {
+        memset(executed, 0, size / 4 * sizeof(uint64_t));
+        memset(taken, 0, size / 4 * sizeof(uint64_t));
+    }
+    outside = 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REPORT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int by_insns(const void *a, const void *b) {
+    const Block *x = a, *y = b;
+    return x->insns < y->insns ? 1 : x->insns > y->insns ? -1 : 0;
+}
+
+static int by_count(const void *a, const void *b) {
+    const Tally *x = a, *y = b;
+    return x->count < y->count ? 1 : x->count > y->count ? -1 : 0;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+    return total ? 100.0 * part / total : 0.0;
+}
+
+/**
+ * @brief Writes "symbol+0xoff" for an address, or the bare address.
+ */
+static void put_location(FILE *out, uint64_t addr) {
+    const Symbol *sym = symbol_lookup(addr);
+
+    if (sym != NULL)
+        fprintf(out, "%s+0x%" PRIx64, sym->name, addr - sym->addr);
+    else
+        fprintf(out, "0x%" PRIx64, addr);
+}
+
+/**
+ * @brief Adds count to the tally named name, appending it if new.
+ */
+static Tally *tally(Tally **list, int *n, const char *name) {
+    int i;
+
+    for (i = 0; i < *n; i++)
+        if (strcmp((*list)[i].name, name) == 0)
+            return &(*list)[i];
+
+    *list = realloc(*list, (*n + 1) * sizeof(Tally));
+    memset(&(*list)[*n], 0, sizeof(Tally));
+    snprintf((*list)[*n].name, sizeof((*list)[*n].name), "%s", name);
+    return &(*list)[(*n)++];
+}
+
+void profile_report(FILE *out, FILE *folded) {
+    Block *blocks = NULL;
+    Tally *opcodes = NULL, *branches = NULL;
+    int nblocks = 0, nopcodes = 0, nbranches = 0, i, boundary = 1;
+    uint64_t w, total = outside;
+
+    if (executed == NULL) {
+        fprintf(out, "Profiling is off (start it with --profile or 'profile on')\n\n");
+        return;
+    }
+
+    for (w = 0; w < size / 4; w++)
+        total += executed[w];
+
+    // One pass over the text: decode what ran, split it into blocks at
+    // control transfers and wherever the execution count changes.
+    for (w = 0; w < size / 4; w++) {
+        Instruction inst;
+
+        if (executed[w] == 0) {
+            boundary = 1;
+            continue;
+        }
+
+        inst = decode(mem_read_32(base + 4 * w));
+        tally(&opcodes, &nopcodes, inst.valid ? inst.name : "(unknown)")->count += executed[w];
+
+        if (inst_ends_block(&inst) && strcmp(inst.name, "HLT") != 0) {
+            branches = realloc(branches, (nbranches + 1) * sizeof(Tally));
+            memset(&branches[nbranches], 0, sizeof(Tally));
+            snprintf(branches[nbranches].name, sizeof(branches[nbranches].name), "%s", inst.name);
+            branches[nbranches].pc = base + 4 * w;
+            branches[nbranches].count = executed[w];
+            branches[nbranches++].taken = taken[w];
+        }
+
+        if (boundary || executed[w] != executed[w - 1]) {
+            blocks = realloc(blocks, (nblocks + 1) * sizeof(Block));
+            blocks[nblocks++] = (Block) { w, 0, executed[w], 0 };
+        }
+        blocks[nblocks - 1].len++;
+        blocks[nblocks - 1].insns += executed[w];
+        boundary = inst_ends_block(&inst) || taken[w] > 0;
+    }
+
+    if (folded != NULL) {
+        for (i = 0; i < nblocks; i++) {
+            uint64_t addr = base + 4 * blocks[i].start;
+            const Symbol *sym = symbol_lookup(addr);
+            fprintf(folded, "%s;0x%" PRIx64 " %" PRIu64 "\n", sym ? sym->name : "text",
+                    addr, blocks[i].insns);
+        }
+        if (outside)
+            fprintf(folded, "[outside text] %" PRIu64 "\n", outside);
+    }
+
+    fprintf(out, "Profile: %" PRIu64 " instructions (%" PRIu64 " outside the text region)\n\n",
+            total, outside);
+
+    qsort(blocks, nblocks, sizeof(Block), by_insns);
+    fprintf(out, "Hot basic blocks:\n");
+    fprintf(out, "  %-10s %-10s %6s %12s %14s %7s  %s\n",
+            "start", "end", "insns", "entries", "retired", "share", "location");
+    for (i = 0; i < nblocks && i < PROFILE_TOP; i++) {
+        uint64_t addr = base + 4 * blocks[i].start;
+        fprintf(out, "  0x%08" PRIx64 " 0x%08" PRIx64 " %6" PRIu64 " %12" PRIu64 " %14" PRIu64
+                " %6.2f%%  ", addr, addr + 4 * (blocks[i].len - 1), blocks[i].len,
+                blocks[i].execs, blocks[i].insns, percent(blocks[i].insns, total));
+        put_location(out, addr);
+        fprintf(out, "\n");
+    }
+
+    qsort(opcodes, nopcodes, sizeof(Tally), by_count);
+    fprintf(out, "\nOpcode classes:\n");
+    for (i = 0; i < nopcodes; i++)
+        fprintf(out, "  %-10s %14" PRIu64 " %6.2f%%\n", opcodes[i].name, opcodes[i].count,
+                percent(opcodes[i].count, total));
+
+    qsort(branches, nbranches, sizeof(Tally), by_count);
+    fprintf(out, "\nBranches:\n");
+    fprintf(out, "  %-10s %-8s %14s %14s\n", "pc", "opcode", "taken", "not taken");
+    for (i = 0; i < nbranches && i < PROFILE_TOP; i++)
+        fprintf(out, "  0x%08" PRIx64 " %-8s %14" PRIu64 " %14" PRIu64 "\n", branches[i].pc,
+                branches[i].name, branches[i].taken, branches[i].count - branches[i].taken);
+    fprintf(out, "\n");
+
+    free(blocks);
+    free(opcodes);
+    free(branches);
+}
+
+// final version
@@ -0,0 +1,60 @@
+/**
+ * @file profile.h
+ * @brief Guest execution profiler: exact per-PC counts over the text region.
+ *
+ * Counters are 64-bit and live in flat arrays parallel to the text
+ * region, one slot per instruction word. Only executions and taken
+ * redirects are counted while the guest runs; opcode classes, branch
+ * outcomes and basic blocks are derived from the text when a report is
+ * made.
+ */
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define PROFILE_TOP 20   ///< Blocks and branches listed in a report
+
+/**
+ * @brief Enables counting. Checked by cycle() before calling profile_retire().
+ */
+extern int profiling;
+
+/**
+ * @brief Allocates the counters for the text region and starts counting.
+ *
+ * @return int 0 on success, -1 if the counters could not be allocated.
+ */
+int profile_start();
+
+/**
+ * @brief Counts one retired instruction.
+ *
+ * @param pc   Address it was fetched from.
+ * @param next Address of the next instruction; anything but pc + 4 is a
+ *             taken branch.
+ */
+void profile_retire(uint64_t pc, uint64_t next);
+
+/**
+ * @brief Zeroes every counter.
+ */
+void profile_reset();
+
+/**
+ * @brief Prints the hot basic blocks, opcode classes and branch outcomes.
+ *
+ * The text is read back from guest memory, so the caller suspends
+ * watchpoints around the call.
+ *
+ * @param out    Report destination.
+ * @param folded If not NULL, also receives one "symbol;block count" line
+ *               per executed block, for flame graph tools.
+ */
+void profile_report(FILE *out, FILE *folded);
+
+#endif // PROFILE_H
+
+// final version
@@ -0,0 +1,199 @@
+/**
+ * @file sample.c
+ * @brief Statistical profiler: periodic samples of the guest PC.
+ */
+
+#include "sample.h"
+#include "shell.h"
+#include "memory.h"
+#include "decoder.h"
+#include "loader.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <sys/time.h>
+
+/**
+ * @struct Bucket
+ * @brief Samples attributed to one block, symbol or opcode class.
+ */
+typedef struct {
+    char name[64];
+    uint64_t samples;
+} Bucket;
+
+static volatile uint32_t *histogram;   ///< One slot per text word
+static volatile uint64_t outside;
+static uint64_t base, size;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * SAMPLING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void sample_tick(int sig) {
+    uint64_t off = CURRENT_STATE.PC - base;
+    (void) sig;
+
+    if (off < size && (off & 3) == 0)
+        histogram[off >> 2]++;
+    else
+        outside++;
+}
+
+int sample_start(unsigned hz) {
+    struct sigaction sa;
+    struct itimerval timer;
+
+    if (hz == 0)
+        hz = SAMPLE_HZ_DEFAULT;
+    if (histogram == NULL) {
+        base = mem_text_region()->start;
+        size = mem_text_region()->size & ~3ull;
+        if ((histogram = calloc(size / 4, sizeof(uint32_t))) == NULL)
+            return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sample_tick;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGPROF, &sa, NULL);
+
+    memset(&timer, 0, sizeof(timer));
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = hz > 1000000 ? 1 : 1000000 / hz;
+    timer.it_value = timer.it_interval;
+    return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void sample_stop() {
+    struct itimerval timer;
+
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+void sample_reset() {
+    if (histogram != NULL)
+        memset((void *) histogram, 0, size / 4 * sizeof(uint32_t));
+    outside = 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REPORT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static int by_samples(const void *a, const void *b) {
+    const Bucket *x = a, *y = b;
+    return x->samples < y->samples ? 1 : x->samples > y->samples ? -1 : 0;
+}
+
+/**
+ * @brief Bucket with the given name, appended if new.
+ */
+static Bucket *bucket(Bucket **list, int *n, const char *name) {
+    int i;
+
+    for (i = 0; i < *n; i++)
+        if (strcmp((*list)[i].name, name) == 0)
+            return &(*list)[i];
+
+    *list = realloc(*list, (*n + 1) * sizeof(Bucket));
+    memset(&(*list)[*n], 0, sizeof(Bucket));
+    snprintf((*list)[*n].name, sizeof((*list)[*n].name), "%s", name);
+    return &(*list)[(*n)++];
+}
+
+/**
+ * @brief Marks block leaders in [0, words): the first word, the word after
+ *        each control transfer and every direct branch target, following
+ *        the executor's idea of where each branch goes.
+ */
+static uint8_t *find_leaders(uint64_t words) {
+    uint8_t *leader = calloc(words + 1, 1);
+    uint64_t w;
+
+    if (leader == NULL)
+        return NULL;
+    leader[0] = 1;
+    for (w = 0; w < words; w++) {
+        Instruction inst = decode(mem_read_32(base + 4 * w));
+        uint64_t target;
+
+        if (!inst_ends_block(&inst))
+            continue;
+        leader[w + 1] = 1;
+        if (strcmp(inst.name, "BR") == 0 || strcmp(inst.name, "HLT") == 0 || inst.imm == 0)
+            continue;
+        target = 4 * w + (int64_t) inst.imm;
+        if (target < 4 * words && (target & 3) == 0)
+            leader[target >> 2] = 1;
+    }
+    return leader;
+}
+
+void sample_report(FILE *out) {
+    Bucket *places = NULL, *opcodes = NULL;
+    int nplaces = 0, nopcodes = 0, i, by_symbol = symbol_count() > 0;
+    uint64_t w, words = 0, total = outside, start = 0;
+    uint8_t *leader = NULL;
+    char name[64];
+
+    if (histogram == NULL) {
+        fprintf(out, "Sampling is off (start it with --sample-hz or 'sample on')\n\n");
+        return;
+    }
+
+    for (w = 0; w < size / 4; w++) {
+        total += histogram[w];
+        if (histogram[w])
+            words = w + 1;
+    }
+    if (!by_symbol && (leader = find_leaders(words)) == NULL)
+        by_symbol = 1;
+
+    for (w = 0; w < words; w++) {
+        uint64_t addr = base + 4 * w;
+        Instruction inst;
+
+        if (!by_symbol && leader[w])
+            start = addr;
+        if (histogram[w] == 0)
+            continue;
+
+        if (by_symbol) {
+            const Symbol *sym = symbol_lookup(addr);
+            snprintf(name, sizeof(name), "%s", sym ? sym->name : "(no symbol)");
+            bucket(&places, &nplaces, name)->samples += histogram[w];
+        } else {
+            snprintf(name, sizeof(name), "0x%08" PRIx64, start);
+            bucket(&places, &nplaces, name)->samples += histogram[w];
+        }
+
+        inst = decode(mem_read_32(addr));
+        bucket(&opcodes, &nopcodes, inst.valid ? inst.name : "(unknown)")->samples += histogram[w];
+    }
+
+    fprintf(out, "Samples: %" PRIu64 " (%" PRIu64 " outside the text region)\n\n", total,
+            (uint64_t) outside);
+
+    qsort(places, nplaces, sizeof(Bucket), by_samples);
+    fprintf(out, by_symbol ? "Hot symbols:\n" : "Hot basic blocks:\n");
+    for (i = 0; i < nplaces && i < SAMPLE_TOP; i++)
+        fprintf(out, "  %-24s %12" PRIu64 " %6.2f%%\n", places[i].name, places[i].samples,
+                total ? 100.0 * places[i].samples / total : 0.0);
+
+    qsort(opcodes, nopcodes, sizeof(Bucket), by_samples);
+    fprintf(out, "\nSampled opcode classes:\n");
+    for (i = 0; i < nopcodes; i++)
+        fprintf(out, "  %-24s %12" PRIu64 " %6.2f%%\n", opcodes[i].name, opcodes[i].samples,
+                total ? 100.0 * opcodes[i].samples / total : 0.0);
+    fprintf(out, "\n");
+
+    free(places);
+    free(opcodes);
+    free(leader);
+}
+
+// final version
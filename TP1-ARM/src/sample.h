@@ -0,0 +1,50 @@
+/**
+ * @file sample.h
+ * @brief Statistical profiler: periodic samples of the guest PC.
+ *
+ * A SIGPROF interval timer interrupts the simulator and the handler adds
+ * one to a histogram slot parallel to the text region, for the PC of the
+ * instruction being simulated. Nothing is added to the cycle loop, so the
+ * cost is one signal per sample. Opcodes and block or symbol attribution
+ * are worked out from the text when a report is made.
+ */
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define SAMPLE_HZ_DEFAULT 1000   ///< Samples per second of simulator CPU time
+#define SAMPLE_TOP 20            ///< Blocks or symbols listed in a report
+
+/**
+ * @brief Allocates the histogram and starts the SIGPROF timer.
+ *
+ * @param hz Samples per second of process CPU time.
+ * @return int 0 on success, -1 if the histogram or timer can't be set up.
+ */
+int sample_start(unsigned hz);
+
+/**
+ * @brief Stops the timer; the histogram is kept.
+ */
+void sample_stop();
+
+/**
+ * @brief Clears the histogram.
+ */
+void sample_reset();
+
+/**
+ * @brief Prints samples by symbol when the program has symbols, otherwise
+ *        by basic block, followed by the sampled opcode classes.
+ *
+ * The text is read back from guest memory, so the caller suspends
+ * watchpoints around the call.
+ */
+void sample_report(FILE *out);
+
+#endif // SAMPLE_H
+
+// final version
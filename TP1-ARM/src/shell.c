@@ -23,36 +23,35 @@
 /* !!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!!! */
 
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
 #include "shell.h"
-
-/***************************************************************/
-/* Main memory.                                                */
-/***************************************************************/
-
-#define MEM_DATA_START  0x10000000
-#define MEM_DATA_SIZE   0x00100000
-#define MEM_TEXT_START  0x00400000
-#define MEM_TEXT_SIZE   0x00100000
-#define MEM_STACK_START 0xfffffffc
-#define MEM_STACK_SIZE  0x00100000
-
-typedef struct {
-    uint64_t start, size;
-    uint8_t *mem;
-} mem_region_t;
-
-/* memory will be dynamically allocated at initialization */
-mem_region_t MEM_REGIONS[] = {
-    { MEM_TEXT_START, MEM_TEXT_SIZE, NULL },
-    { MEM_DATA_START, MEM_DATA_SIZE, NULL },
-    { MEM_STACK_START, MEM_STACK_SIZE, NULL },
-};
-
-#define MEM_NREGIONS (sizeof(MEM_REGIONS)/sizeof(mem_region_t))
+#include "memory.h"
+#include "watch.h"
+#include "console.h"
+#include "snapshot.h"
+#include "loader.h"
+#include "dump.h"
+#include "writer.h"
+#include "loop.h"
+#include "trap.h"
+#include "profile.h"
+#include "sample.h"
+#include "hoststat.h"
+#include "stats.h"
+#include "coverage.h"
+#include "plugin.h"
+#include "history.h"
+#include "timeline.h"
+#include "pmu.h"
+#include "instrument.h"
 
 /***************************************************************/
 /* CPU State info.                                             */
@@ -60,58 +59,40 @@ mem_region_t MEM_REGIONS[] = {
 
 CPU_State CURRENT_STATE, NEXT_STATE;
 int RUN_BIT;	/* run bit */
-int INSTRUCTION_COUNT;
+uint64_t INSTRUCTION_COUNT;
+uint64_t PROGRAM_ENTRY = MEM_TEXT_START;	/* initial PC */
+int ONE_SHOT;		/* --run: no banners, no REPL */
+uint64_t DUMP_EVERY;	/* --dump-every: instructions between periodic dumps */
+uint64_t DUMP_COUNTDOWN;
 
+/* Watchdog for unattended runs */
+#define WATCHDOG_BATCH 4096	/* cycles between limit checks */
 
-/***************************************************************/
-/*                                                             */
-/* Procedure: mem_read_32                                      */
-/*                                                             */
-/* Purpose: Read a 32-bit word from memory                     */
-/*                                                             */
-/***************************************************************/
-uint32_t mem_read_32(uint64_t address)
-{
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
+#define STOP_NONE     0
+#define STOP_BUDGET   1		/* --max-insns reached */
+#define STOP_TIMEOUT  2		/* --timeout expired */
+#define STOP_LOOP     3		/* --detect-loops saw the state repeat */
+#define STOP_TRAP     4		/* --trap halt on an unknown instruction */
 
-            return
-                (MEM_REGIONS[i].mem[offset+3] << 24) |
-                (MEM_REGIONS[i].mem[offset+2] << 16) |
-                (MEM_REGIONS[i].mem[offset+1] <<  8) |
-                (MEM_REGIONS[i].mem[offset+0] <<  0);
-        }
-    }
+static const char *STOP_NAMES[] = { NULL, "max-insns", "timeout", "loop", "trap" };
+static const int STOP_EXIT[] = { 0, 2, 3, 4, 5 };	/* process exit codes */
 
-    return 0;
-}
+uint64_t MAX_INSNS;	/* 0: no budget */
+volatile sig_atomic_t TIMED_OUT;
+int STOP_REASON;
+
+/* Batch mode result record */
+typedef struct {
+  uint64_t start;
+  uint32_t count;
+  uint32_t *words;
+} RecordRange;
+
+FILE *RECORD;		/* record destination, NULL outside batch mode */
+RecordRange *RANGES;
+int NUM_RANGES;
 
-/***************************************************************/
-/*                                                             */
-/* Procedure: mem_write_32                                     */
-/*                                                             */
-/* Purpose: Write a 32-bit word to memory                      */
-/*                                                             */
-/***************************************************************/
-void mem_write_32(uint64_t address, uint32_t value)
-{
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        if (address >= MEM_REGIONS[i].start &&
-                address < (MEM_REGIONS[i].start + MEM_REGIONS[i].size)) {
-            uint32_t offset = address - MEM_REGIONS[i].start;
 
-            MEM_REGIONS[i].mem[offset+3] = (value >> 24) & 0xFF;
-            MEM_REGIONS[i].mem[offset+2] = (value >> 16) & 0xFF;
-            MEM_REGIONS[i].mem[offset+1] = (value >>  8) & 0xFF;
-            MEM_REGIONS[i].mem[offset+0] = (value >>  0) & 0xFF;
-            return;
-        }
-    }
-}
 /***************************************************************/
 /*                                                             */
 /* Procedure : help                                            */
@@ -124,8 +105,19 @@ void help() {
   printf("go               -  run program to completion         \n");
   printf("run n            -  execute program for n instructions\n");
   printf("mdump low high   -  dump memory from low to high      \n");
+  printf("mdump dirty      -  dump pages written since last one \n");
   printf("rdump            -  dump the register & bus values    \n");
   printf("input reg_no reg_value - set GPR reg_no to reg_value  \n");
+  printf("reset            -  restore memory and registers      \n");
+  printf("watch addr len [r|w|rw] - stop on access to memory    \n");
+  printf("snapshot         -  save registers and memory         \n");
+  printf("diff             -  compare machine with the snapshot \n");
+  printf("profile [file]   -  hot blocks; folded stacks to file  \n");
+  printf("profile on|off|reset - control the execution profiler \n");
+  printf("sample [on [hz]|off|reset] - sampled hot blocks or symbols\n");
+  printf("hoststats [on|off|reset] - host counters per phase and opcode\n");
+  printf("history [n]      -  last n retired instructions (32)  \n");
+  printf("stats            -  speed and slice time histogram  \n");
   printf("?                -  display this help menu            \n");
   printf("quit             -  exit the program                  \n\n");
 }
@@ -140,8 +132,133 @@ void help() {
 void cycle() {                                                
 
   process_instruction();
+  // Nothing retired: NEXT_STATE is CURRENT_STATE, PC included.
+  if (trap_stopped)
+    return;
+  INSTR_RETIRE(CURRENT_STATE.PC, NEXT_STATE.PC);
   CURRENT_STATE = NEXT_STATE;
+  INSTR_COPIED();
   INSTRUCTION_COUNT++;
+  if (watch_pending)
+    watch_after_cycle();
+  if (DUMP_EVERY && --DUMP_COUNTDOWN == 0) {
+    DUMP_COUNTDOWN = DUMP_EVERY;
+    writer_registers(&CURRENT_STATE, INSTRUCTION_COUNT, WRITER_FILE);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : stopped                                         */
+/*                                                             */
+/* Purpose   : Tell a watchpoint stop from a halt and make the */
+/*             machine runnable again after the former.        */
+/*                                                             */
+/***************************************************************/
+int stopped() {
+  if (!watch_stopped)
+    return FALSE;
+
+  watch_stopped = FALSE;
+  RUN_BIT = TRUE;
+  printf("Stopped at watchpoint\n\n");
+  return TRUE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : simulate                                        */
+/*                                                             */
+/* Purpose   : Execute up to n cycles, or until RUN_BIT drops, */
+/*             in batches. The instruction budget, the timeout */
+/*             flag and pending trap reports are checked       */
+/*             between batches only. Returns the STOP_* reason */
+/*             the run was stopped for.                        */
+/*                                                             */
+/***************************************************************/
+int simulate(uint64_t n) {
+  uint64_t batch;
+  int reason = STOP_NONE;
+
+  stats_begin();
+  while (n > 0 && RUN_BIT && reason == STOP_NONE) {
+    batch = n < WATCHDOG_BATCH ? n : WATCHDOG_BATCH;
+    if (batch > stats_slice_left())
+      batch = stats_slice_left();
+    if (MAX_INSNS) {
+      if (INSTRUCTION_COUNT >= MAX_INSNS) {
+        reason = STOP_BUDGET;
+        break;
+      }
+      if (batch > MAX_INSNS - INSTRUCTION_COUNT)
+        batch = MAX_INSNS - INSTRUCTION_COUNT;
+    }
+    n -= batch;
+    while (batch-- > 0 && RUN_BIT)
+      cycle();
+    stats_batch();
+    if (trap_pending)
+      trap_flush(stdout);
+
+    if (trap_stopped) {
+      trap_stopped = FALSE;
+      reason = STOP_TRAP;
+    }
+    else if (loop_stopped) {
+      loop_stopped = FALSE;
+      RUN_BIT = TRUE;
+      reason = STOP_LOOP;
+    }
+    else if (TIMED_OUT)
+      reason = STOP_TIMEOUT;
+  }
+  stats_end();
+  trap_summary(stdout);
+  if (reason != STOP_NONE)
+    STOP_REASON = reason;
+  return reason;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : limit_reached                                   */
+/*                                                             */
+/* Purpose   : Report why the run was stopped early.           */
+/*                                                             */
+/***************************************************************/
+void limit_reached(FILE * out, int reason) {
+  console_flush();
+  if (reason == STOP_BUDGET)
+    fprintf(out, "Stopped: instruction budget of %" PRIu64 " exhausted\n\n", MAX_INSNS);
+  else if (reason == STOP_LOOP)
+    loop_report(out);
+  else if (reason == STOP_TRAP)
+    trap_report_halt(out);
+  else
+    fprintf(out, "Stopped: timeout expired\n\n");
+  history_stopped(out);
+}
+
+static void watchdog_alarm(int sig) {
+  (void) sig;
+  TIMED_OUT = TRUE;
+}
+
+/* Arm a one-shot wall-clock timer that only raises TIMED_OUT */
+void watchdog_start(uint64_t timeout_ms) {
+  struct sigaction sa;
+  struct itimerval timer;
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = watchdog_alarm;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGALRM, &sa, NULL);
+
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = timeout_ms / 1000;
+  timer.it_value.tv_usec = (timeout_ms % 1000) * 1000;
+  setitimer(ITIMER_REAL, &timer, NULL);
 }
 
 /***************************************************************/
@@ -152,7 +269,8 @@ void cycle() {
 /*                                                             */
 /***************************************************************/
 void run(int num_cycles) {                                      
-  int i;
+  uint64_t start = INSTRUCTION_COUNT;
+  int reason;
 
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
@@ -160,13 +278,19 @@ void run(int num_cycles) {
   }
 
   printf("Simulating for %d cycles...\n\n", num_cycles);
-  for (i = 0; i < num_cycles; i++) {
-    if (RUN_BIT == FALSE) {
-	    printf("Simulator halted\n\n");
-	    break;
+  if (num_cycles > 0 && (reason = simulate(num_cycles)) != STOP_NONE)
+    limit_reached(stdout, reason);
+  else {
+    if (RUN_BIT == FALSE && INSTRUCTION_COUNT - start < (uint64_t) num_cycles) {
+      if (!stopped())
+        printf("Simulator halted\n\n");
     }
-    cycle();
+    else if (RUN_BIT == FALSE)
+      stopped();
+    console_flush();
   }
+  if (stats_summary)
+    stats_last_run(stdout);
 }
 
 /***************************************************************/ 
@@ -174,24 +298,30 @@ void run(int num_cycles) {
 /* Procedure : mdump                                           */
 /*                                                             */
 /* Purpose   : Dump a word-aligned region of memory to the     */
-/*             output file.                                    */
+/*             output file. Only the copy happens here; the    */
+/*             writer thread formats it.                       */
 /*                                                             */
 /***************************************************************/
-void mdump(FILE * dumpsim_file, int start, int stop) {          
-  int address;
+void mdump(FILE * dumpsim_file, uint64_t start, uint64_t stop) {
+  watch_suspend();
+  writer_memory(start, stop, WRITER_STDOUT | (dumpsim_file ? WRITER_FILE : 0));
+  watch_resume();
+}
 
-  printf("\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  printf("-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    printf("  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  printf("\n");
+/***************************************************************/
+/*                                                             */
+/* Procedure : mdump_dirty                                     */
+/*                                                             */
+/* Purpose   : Dump only the pages written since the previous  */
+/*             incremental dump.                               */
+/*                                                             */
+/***************************************************************/
+static void mdump_range(uint64_t start, uint64_t size, void *ctx) {
+  mdump((FILE *) ctx, start, start + size - 4);
+}
 
-  /* dump the memory contents into the dumpsim file */
-  fprintf(dumpsim_file, "\nMemory content [0x%08x..0x%08x] :\n", start, stop);
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  for (address = start; address <= stop; address += 4)
-    fprintf(dumpsim_file, "  0x%08x (%d) : 0x%x\n", address, address, mem_read_32(address));
-  fprintf(dumpsim_file, "\n");
+void mdump_dirty(FILE * dumpsim_file) {
+  mem_for_each_dirty(MEM_DIRTY_DUMP, TRUE, mdump_range, dumpsim_file);
 }
 
 /***************************************************************/
@@ -199,35 +329,233 @@ void mdump(FILE * dumpsim_file, int start, int stop) {
 /* Procedure : rdump                                           */
 /*                                                             */
 /* Purpose   : Dump current register and bus values to the     */   
-/*             output file.                                    */
+/*             output file (through the writer thread).        */
 /*                                                             */
 /***************************************************************/
-void rdump(FILE * dumpsim_file) {                               
-  int k; 
+void rdump(FILE * dumpsim_file) {
+  writer_registers(&CURRENT_STATE, INSTRUCTION_COUNT,
+                   WRITER_STDOUT | (dumpsim_file ? WRITER_FILE : 0));
+}
+/***************************************************************/
+/*                                                             */
+/* Procedure : reset                                           */
+/*                                                             */
+/* Purpose   : Return the machine to its just-loaded state.    */
+/*             Only pages written since the last reset are     */
+/*             restored, so the cost follows what ran.         */
+/*                                                             */
+/***************************************************************/
+void reset() {
+  int pages;
 
-  printf("\nCurrent register/bus values :\n");
-  printf("-------------------------------------\n");
-  printf("Instruction Count : %u\n", INSTRUCTION_COUNT);
-  printf("PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  printf("Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    printf("X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  printf("FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  printf("FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  printf("\n");
+  watch_suspend();
+  pages = mem_reset();
+  watch_resume();
 
-  /* dump the state information into the dumpsim file */
-  fprintf(dumpsim_file, "\nCurrent register/bus values :\n");
-  fprintf(dumpsim_file, "-------------------------------------\n");
-  fprintf(dumpsim_file, "Instruction Count : %u\n", INSTRUCTION_COUNT);
-  fprintf(dumpsim_file, "PC                : 0x%" PRIx64 "\n", CURRENT_STATE.PC);
-  fprintf(dumpsim_file, "Registers:\n");
-  for (k = 0; k < ARM_REGS; k++)
-    fprintf(dumpsim_file, "X%d: 0x%" PRIx64 "\n", k, CURRENT_STATE.REGS[k]);
-  fprintf(dumpsim_file, "FLAG_N: %d\n", CURRENT_STATE.FLAG_N);
-  fprintf(dumpsim_file, "FLAG_Z: %d\n", CURRENT_STATE.FLAG_Z);
-  fprintf(dumpsim_file, "\n");
+  memset(&CURRENT_STATE, 0, sizeof(CURRENT_STATE));
+  CURRENT_STATE.PC = PROGRAM_ENTRY;
+  NEXT_STATE = CURRENT_STATE;
+  INSTRUCTION_COUNT = 0;
+  DUMP_COUNTDOWN = DUMP_EVERY;
+  RUN_BIT = TRUE;
+  loop_reset();
+  trap_reset();
+  profile_reset();
+  sample_reset();
+  hoststat_reset();
+  stats_reset();
+  coverage_reset();
+  timeline_reset();
+  pmu_reset();
+
+  printf("Machine reset (%d dirty pages restored)\n\n", pages);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : snapshot / diff                                 */
+/*                                                             */
+/* Purpose   : Save the machine state and later report what    */
+/*             changed since.                                  */
+/*                                                             */
+/***************************************************************/
+Snapshot SAVED_STATE;
+
+void snapshot() {
+  watch_suspend();
+  snapshot_take(&SAVED_STATE);
+  watch_resume();
+  printf("Snapshot taken at instruction %" PRIu64 "\n\n", INSTRUCTION_COUNT);
+}
+
+void diff() {
+  Snapshot live;
+
+  if (SAVED_STATE.nregions == 0) {
+    printf("No snapshot taken\n\n");
+    return;
+  }
+
+  watch_suspend();
+  snapshot_live(&live);
+  snapshot_diff(&SAVED_STATE, &live, stdout);
+  watch_resume();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : instrumented                                    */
+/*                                                             */
+/* Purpose   : Tell whether this build has the hooks a tool    */
+/*             needs, and name the build that does if not.     */
+/*                                                             */
+/***************************************************************/
+int instrumented(int level, const char *tool) {
+  if (SIM_INSTRUMENT >= level)
+    return TRUE;
+  printf("%s is not built into this simulator; use %s\n\n", tool,
+         level == INSTRUMENT_PROF ? "sim-prof or sim-trace" : "sim-trace");
+  return FALSE;
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : profile                                         */
+/*                                                             */
+/* Purpose   : Control the execution profiler or print its     */
+/*             report, optionally with folded stacks to a file.*/
+/*                                                             */
+/***************************************************************/
+void profile(char *args) {
+  char arg[256];
+  FILE *folded = NULL;
+
+  if (sscanf(args, "%255s", arg) != 1)
+    arg[0] = '\0';
+
+  if (strcmp(arg, "on") == 0) {
+    if (!instrumented(INSTRUMENT_PROF, "The execution profiler"))
+      return;
+    if (profile_start() < 0)
+      printf("Can't allocate the profile counters\n\n");
+    else
+      printf("Profiling on\n\n");
+    return;
+  }
+  if (strcmp(arg, "off") == 0) {
+    profiling = FALSE;
+    printf("Profiling off\n\n");
+    return;
+  }
+  if (strcmp(arg, "reset") == 0) {
+    profile_reset();
+    printf("Profile cleared\n\n");
+    return;
+  }
+
+  if (arg[0] != '\0' && (folded = fopen(arg, "w")) == NULL) {
+    printf("Can't write %s\n\n", arg);
+    return;
+  }
+  watch_suspend();
+  profile_report(stdout, folded);
+  watch_resume();
+  if (folded != NULL) {
+    fclose(folded);
+    printf("Folded stacks written to %s\n\n", arg);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : sample                                          */
+/*                                                             */
+/* Purpose   : Control the sampling profiler or print its      */
+/*             report.                                         */
+/*                                                             */
+/***************************************************************/
+void sample(char *args) {
+  char arg[20];
+  unsigned hz = 0;
+
+  if (sscanf(args, "%19s %u", arg, &hz) < 1)
+    arg[0] = '\0';
+
+  if (strcmp(arg, "on") == 0) {
+    if (sample_start(hz) < 0)
+      printf("Can't start sampling\n\n");
+    else
+      printf("Sampling at %u Hz\n\n", hz ? hz : SAMPLE_HZ_DEFAULT);
+    return;
+  }
+  if (strcmp(arg, "off") == 0) {
+    sample_stop();
+    printf("Sampling off\n\n");
+    return;
+  }
+  if (strcmp(arg, "reset") == 0) {
+    sample_reset();
+    printf("Samples cleared\n\n");
+    return;
+  }
+
+  watch_suspend();
+  sample_report(stdout);
+  watch_resume();
 }
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : hoststat                                        */
+/*                                                             */
+/* Purpose   : Control the host performance counters or print  */
+/*             their report.                                   */
+/*                                                             */
+/***************************************************************/
+void hoststat(char *args) {
+  char arg[20];
+
+  if (sscanf(args, "%19s", arg) != 1)
+    arg[0] = '\0';
+
+  if (strcmp(arg, "on") == 0) {
+    if (!instrumented(INSTRUMENT_PROF, "Host counting"))
+      return;
+    if (hoststat_start(stdout) < 0)
+      printf("No host counters available\n\n");
+    else
+      printf("Host counters on\n\n");
+    return;
+  }
+  if (strcmp(arg, "off") == 0) {
+    hoststat_stop();
+    printf("Host counters off\n\n");
+    return;
+  }
+  if (strcmp(arg, "reset") == 0) {
+    hoststat_reset();
+    printf("Host counters cleared\n\n");
+    return;
+  }
+
+  hoststat_report(stdout);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : history                                         */
+/*                                                             */
+/* Purpose   : Print the last retired instructions.            */
+/*                                                             */
+/***************************************************************/
+void history(char *args) {
+  unsigned count;
+
+  if (sscanf(args, "%u", &count) != 1)
+    count = HISTORY_TAIL;
+  history_dump(stdout, count);
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : go                                              */
@@ -235,55 +563,98 @@ void rdump(FILE * dumpsim_file) {
 /* Purpose   : Simulate ARM until HALTed                       */
 /*                                                             */
 /***************************************************************/
-void go(FILE * dumpsim_file) {                                                     
+void go() {
+  int reason;
+
   if (RUN_BIT == FALSE) {
     printf("Can't simulate, Simulator is halted\n\n");
     return;
   }
 
   printf("Simulating...\n\n");
-  while (RUN_BIT) {
-    cycle();
-    //printf("Going\n");
-    //rdump(dumpsim_file);
-    //mdump(dumpsim_file, MEM_DATA_START, MEM_DATA_START+0x100);
+  if ((reason = simulate(UINT64_MAX)) != STOP_NONE)
+    limit_reached(stdout, reason);
+  else {
+    console_flush();
+    if (!stopped())
+      printf("Simulator halted\n\n");
   }
-  printf("Simulator halted\n\n");
+  if (stats_summary)
+    stats_last_run(stdout);
 }
 
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : get_command                                     */
+/* Procedure : record_range                                    */
+/*                                                             */
+/* Purpose   : Keep a memory range asked for in batch mode for */
+/*             the result record.                              */
+/*                                                             */
+/***************************************************************/
+void record_range(uint64_t start, uint64_t stop) {
+  RecordRange *r;
+  uint64_t address;
+
+  if (stop < start)
+    return;
+
+  RANGES = realloc(RANGES, (NUM_RANGES + 1) * sizeof(RecordRange));
+  r = &RANGES[NUM_RANGES++];
+  r->start = start & ~3ull;
+  r->count = ((stop & ~3ull) - r->start) / 4 + 1;
+  r->words = malloc(r->count * sizeof(uint32_t));
+
+  watch_suspend();
+  for (address = 0; address < r->count; address++)
+    r->words[address] = mem_read_32(r->start + 4 * address);
+  watch_resume();
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : execute_command                                 */
 /*                                                             */
-/* Purpose   : Read a command from standard input.             */  
+/* Purpose   : Execute one shell command line. Returns FALSE   */
+/*             for quit.                                       */
 /*                                                             */
 /***************************************************************/
-void get_command(FILE * dumpsim_file) {                         
+int execute_command(FILE * dumpsim_file, char *line) {
   char buffer[20];
-  int start, stop, cycles;
+  char arg[20];
+  char *args;
+  uint64_t start, stop;
+  int cycles, mode, n;
   int register_no;
   int64_t register_value;
 
-  printf("ARM-SIM> ");
-
-  if (scanf("%s", buffer) == EOF)
-      exit(0);
-
-  printf("\n");
+  if (sscanf(line, "%19s%n", buffer, &n) != 1)
+    return TRUE;
+  args = line + n;
 
   switch(buffer[0]) {
   case 'G':
   case 'g':
-    go(dumpsim_file);
+    go();
     break;
 
   case 'M':
   case 'm':
-    if (scanf("%i %i", &start, &stop) != 2)
+    if (sscanf(args, "%19s%n", arg, &n) != 1)
+        break;
+
+    if (arg[0] == 'd' || arg[0] == 'D') {
+      mdump_dirty(dumpsim_file);
+      break;
+    }
+
+    start = strtoull(arg, NULL, 0);
+    if (sscanf(args + n, "%" SCNi64, (int64_t *) &stop) != 1)
         break;
 
     mdump(dumpsim_file, start, stop);
+    if (RECORD != NULL)
+      record_range(start, stop);
     break;
 
   case '?':
@@ -292,47 +663,203 @@ void get_command(FILE * dumpsim_file) {
 
   case 'Q':
   case 'q':
-    printf("Bye.\n");
-    exit(0);
+    return FALSE;
 
   case 'R':
   case 'r':
     if (buffer[1] == 'd' || buffer[1] == 'D')
 	    rdump(dumpsim_file);
+    else if (buffer[1] == 'e' || buffer[1] == 'E')
+	    reset();
     else {
-	    if (scanf("%d", &cycles) != 1) break;
+	    if (sscanf(args, "%d", &cycles) != 1) break;
 	    run(cycles);
     }
     break;
 
   case 'I':
   case 'i':
-   if (scanf("%i %" PRIx64, &register_no, &register_value) != 2)
+   if (sscanf(args, "%i %" PRIx64, &register_no, &register_value) != 2)
       break;
    CURRENT_STATE.REGS[register_no] = register_value;
    NEXT_STATE.REGS[register_no] = register_value;
+   loop_reset();
    break;
 
+  case 'S':
+  case 's':
+    if (buffer[1] == 'a' || buffer[1] == 'A')
+      sample(args);
+    else if (buffer[1] == 't' || buffer[1] == 'T')
+      stats_report(stdout);
+    else
+      snapshot();
+    break;
+
+  case 'D':
+  case 'd':
+    diff();
+    break;
+
+  case 'P':
+  case 'p':
+    profile(args);
+    break;
+
+  case 'H':
+  case 'h':
+    if (buffer[1] == 'i' || buffer[1] == 'I')
+      history(args);
+    else
+      hoststat(args);
+    break;
+
+  case 'W':
+  case 'w':
+    if (sscanf(args, "%" SCNi64 " %" SCNi64 "%n", (int64_t *) &start, (int64_t *) &stop, &n) != 2)
+        break;
+
+    mode = WATCH_WRITE;
+    if (sscanf(args + n, "%19s", arg) == 1)
+        mode = (strchr(arg, 'r') ? WATCH_READ : 0) | (strchr(arg, 'w') ? WATCH_WRITE : 0);
+
+    if ((register_no = watch_add(start, stop, mode)) < 0)
+        printf("Can't watch 0x%" PRIx64 " (%" PRIu64 " bytes)\n\n", start, stop);
+    else
+        printf("Watchpoint %d: 0x%" PRIx64 " (%" PRIu64 " bytes)\n\n", register_no, start, stop);
+    break;
+
   default:
     printf("Invalid Command\n");
     break;
   }
+  return TRUE;
 }
 
 /***************************************************************/
 /*                                                             */
-/* Procedure : init_memory                                     */
+/* Procedure : get_command                                     */
 /*                                                             */
-/* Purpose   : Allocate and zero memory                        */
+/* Purpose   : Read a command from standard input.             */
 /*                                                             */
 /***************************************************************/
-void init_memory() {                                           
-    int i;
-    for (i = 0; i < MEM_NREGIONS; i++) {
-        // Extra 3 bytes to prevent buffer overflow on unaligned access.
-        MEM_REGIONS[i].mem = malloc(MEM_REGIONS[i].size + 3);
-        memset(MEM_REGIONS[i].mem, 0, MEM_REGIONS[i].size);
-    }
+void get_command(FILE * dumpsim_file) {
+  char line[256];
+  int more;
+
+  printf("ARM-SIM> ");
+
+  if (fgets(line, sizeof(line), stdin) == NULL)
+      exit(0);
+
+  printf("\n");
+
+  more = execute_command(dumpsim_file, line);
+  writer_drain();
+  if (!more) {
+    printf("Bye.\n");
+    exit(0);
+  }
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : write_record                                    */
+/*                                                             */
+/* Purpose   : Emit the final machine state and the recorded   */
+/*             memory ranges as one JSON object on one line.   */
+/*                                                             */
+/***************************************************************/
+void write_record(FILE * out) {
+  int k;
+  uint32_t i;
+
+  fprintf(out, "{\"pc\":\"0x%" PRIx64 "\",\"icount\":%" PRIu64 ",\"halted\":%s,",
+          CURRENT_STATE.PC, INSTRUCTION_COUNT, RUN_BIT ? "false" : "true");
+  if (STOP_REASON != STOP_NONE)
+    fprintf(out, "\"stop\":\"%s\",", STOP_NAMES[STOP_REASON]);
+  else
+    fprintf(out, "\"stop\":null,");
+  fprintf(out, "\"traps\":%" PRIu64 ",", trap_count);
+  fprintf(out, "\"flags\":{\"n\":%d,\"z\":%d},\"regs\":[",
+          CURRENT_STATE.FLAG_N, CURRENT_STATE.FLAG_Z);
+  for (k = 0; k < ARM_REGS; k++)
+    fprintf(out, "%s\"0x%" PRIx64 "\"", k ? "," : "", CURRENT_STATE.REGS[k]);
+  fprintf(out, "],\"memory\":[");
+  for (k = 0; k < NUM_RANGES; k++) {
+    fprintf(out, "%s{\"addr\":\"0x%" PRIx64 "\",\"words\":[", k ? "," : "", RANGES[k].start);
+    for (i = 0; i < RANGES[k].count; i++)
+      fprintf(out, "%s\"0x%08x\"", i ? "," : "", RANGES[k].words[i]);
+    fprintf(out, "]}");
+  }
+  fprintf(out, "]}\n");
+  fflush(out);
+}
+
+/***************************************************************/
+/*                                                             */
+/* Procedure : run_script                                      */
+/*                                                             */
+/* Purpose   : Batch mode: execute commands separated by ';'   */
+/*             or newlines without prompts, then write the     */
+/*             result record. stdout carries only the record;  */
+/*             command output goes to stderr. A watchdog stop  */
+/*             ends the script early.                          */
+/*                                                             */
+/***************************************************************/
+void run_script(FILE * dumpsim_file, char *script) {
+  char *line, *next;
+  int fd;
+
+  fflush(stdout);
+  fd = dup(STDOUT_FILENO);
+  RECORD = fdopen(fd, "w");
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  for (line = script; line != NULL; line = next) {
+    next = strpbrk(line, ";\n");
+    if (next != NULL)
+      *next++ = '\0';
+    if (!execute_command(dumpsim_file, line))
+      break;
+    writer_drain();
+    if (STOP_REASON != STOP_NONE)
+      break;
+  }
+
+  console_flush();
+  fflush(stdout);
+  write_record(RECORD);
+  exit(STOP_EXIT[STOP_REASON]);
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : load_failed                                    */
+/*                                                            */
+/* Purpose   : Report why a program file could not be loaded  */
+/*             and exit.                                      */
+/*                                                            */
+/**************************************************************/
+void load_failed(int rc, char *program_filename, LoadResult *loaded) {
+  switch (rc) {
+  case LOADER_ERR_OPEN:
+    printf("Error: Can't open program file %s\n", program_filename);
+    break;
+  case LOADER_ERR_MALFORMED:
+    if (loaded->error != NULL)
+      printf("Error: %s:%d: %s\n", program_filename, loaded->line, loaded->error);
+    else
+      printf("Error: Malformed program file %s (line %d)\n", program_filename, loaded->line);
+    break;
+  case LOADER_ERR_TOO_BIG:
+    printf("Error: Program file %s does not fit in memory\n", program_filename);
+    break;
+  case LOADER_ERR_FORMAT:
+    printf("Error: %s is not an aarch64 ELF64 file\n", program_filename);
+    break;
+  }
+  exit(-1);
 }
 
 /**************************************************************/
@@ -342,33 +869,191 @@ void init_memory() {
 /* Purpose   : Load program and service routines into mem.    */
 /*                                                            */
 /**************************************************************/
-void load_program(char *program_filename) {                   
-  FILE * prog;
-  int ii, word;
+void load_program(char *program_filename) {
+  LoadResult loaded;
+  int rc;
 
-  /* Open program file. */
-  prog = fopen(program_filename, "r");
-  if (prog == NULL) {
-    printf("Error: Can't open program file %s\n", program_filename);
+  /* Map the program file and place it straight into guest memory. */
+  if ((rc = load_image(program_filename, &loaded)) != LOADER_OK)
+    load_failed(rc, program_filename, &loaded);
+
+  CURRENT_STATE.PC = PROGRAM_ENTRY = loaded.entry;
+
+  if (ONE_SHOT)
+    return;
+  if (!loaded.elf) {
+    printf("Read %d words from program into memory.\n\n", (int) (loaded.size / 4));
+    return;
+  }
+
+  printf("Read %d words of text and %d bytes of data from ELF program, %d symbols.\n",
+         (int) (loaded.size / 4), (int) loaded.data, symbol_count());
+  if (loaded.relocs)
+    printf("Warning: %d relocations in %s were not applied.\n", loaded.relocs,
+           program_filename);
+  printf("\n");
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : run_once                                       */
+/*                                                            */
+/* Purpose   : One-shot mode: run to HLT, print the final     */
+/*             state and exit. With timing, report startup    */
+/*             and run times on stderr. A watchdog stop is    */
+/*             reported on stderr and in the exit code.       */
+/*                                                            */
+/**************************************************************/
+static double elapsed_us(const struct timespec *from) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - from->tv_sec) * 1e6 + (now.tv_nsec - from->tv_nsec) / 1e3;
+}
+
+void run_once(FILE * dumpsim_file, const struct timespec *started, int timing) {
+  double startup = elapsed_us(started);
+  int reason = simulate(UINT64_MAX);
+  double total = elapsed_us(started);
+
+  if (reason != STOP_NONE)
+    limit_reached(stderr, reason);
+  console_flush();
+  rdump(dumpsim_file);
+  writer_drain();
+  fflush(stdout);
+
+  if (timing)
+    fprintf(stderr, "startup %.1f us to first instruction, %.1f us total, %" PRIu64 " instructions\n",
+            startup, total, INSTRUCTION_COUNT);
+  if (stats_summary)
+    stats_report(stderr);
+  exit(STOP_EXIT[STOP_REASON]);
+}
+
+/**************************************************************/
+/*                                                            */
+/* Procedure : read_script / append_script                    */
+/*                                                            */
+/* Purpose   : Gather the commands of --script files and -e   */
+/*             options, in order, into one buffer.            */
+/*                                                            */
+/**************************************************************/
+char *read_script(char *path) {
+  FILE *f = fopen(path, "r");
+  char *text = NULL;
+  size_t len = 0, n;
+  char chunk[4096];
+
+  if (f == NULL) {
+    printf("Error: Can't open script file %s\n", path);
     exit(-1);
   }
+  while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+    text = realloc(text, len + n + 1);
+    memcpy(text + len, chunk, n);
+    len += n;
+  }
+  fclose(f);
+  if (text == NULL)
+    text = calloc(1, 1);
+  text[len] = '\0';
+  return text;
+}
+
+char *append_script(char *script, const char *commands) {
+  size_t len = script ? strlen(script) : 0;
 
-  /* Read in the program. */
+  script = realloc(script, len + strlen(commands) + 2);
+  strcpy(script + len, commands);
+  strcat(script + len, "\n");
+  return script;
+}
 
-  ii = 0;
-  int bytes_read = EOF;
-  while ((bytes_read=fscanf(prog, "%x\n", &word)) > 0) {
-    mem_write_32(MEM_TEXT_START + ii, word);
-    ii += 4;
+/**************************************************************/
+/*                                                            */
+/* Procedure : assemble                                       */
+/*                                                            */
+/* Purpose   : Assemble a .s file into a hex image (.x) with  */
+/*             the built-in assembler.                        */
+/*                                                            */
+/**************************************************************/
+void assemble(char *source, char *output) {
+  LoadResult loaded;
+  char *derived = NULL;
+  int rc;
+
+  if (output == NULL) {
+    /* prog.s -> prog.x */
+    char *dot = strrchr(source, '.');
+    size_t stem = dot != NULL && strchr(dot, '/') == NULL ? (size_t) (dot - source) : strlen(source);
+    derived = malloc(stem + 3);
+    memcpy(derived, source, stem);
+    strcpy(derived + stem, ".x");
+    output = derived;
   }
-  if (bytes_read == 0) {
-    printf("Error: Malformed program file %s\n", program_filename);
+
+  init_memory();
+  if ((rc = load_image(source, &loaded)) != LOADER_OK)
+    load_failed(rc, source, &loaded);
+
+  if (save_hex_image(output, MEM_TEXT_START, loaded.size) != LOADER_OK) {
+    printf("Error: Can't write %s\n", output);
     exit(-1);
   }
+  printf("Assembled %d words into %s\n", (int) (loaded.size / 4), output);
+  free(derived);
+}
 
-  CURRENT_STATE.PC = MEM_TEXT_START;
+/**************************************************************/
+/*                                                            */
+/* Procedure : dump_text                                      */
+/*                                                            */
+/* Purpose   : Convert a binary dumpsim file to the text      */
+/*             format and exit.                               */
+/*                                                            */
+/**************************************************************/
+void dump_text(char *input, char *output) {
+  FILE *in, *out = stdout;
+
+  if ((in = fopen(input, "rb")) == NULL) {
+    printf("Error: Can't open %s\n", input);
+    exit(-1);
+  }
+  if (output != NULL && (out = fopen(output, "w")) == NULL) {
+    printf("Error: Can't write %s\n", output);
+    exit(-1);
+  }
+  if (writer_convert(in, out) < 0) {
+    fprintf(stderr, "Error: %s is not a binary dumpsim file or is truncated\n", input);
+    exit(-1);
+  }
+  fclose(in);
+  fclose(out);
+  exit(0);
+}
 
-  printf("Read %d words from program into memory.\n\n", ii/4);
+/**************************************************************/
+/*                                                            */
+/* Procedure : cov_merge                                      */
+/*                                                            */
+/* Purpose   : Merge coverage maps of many runs of a program  */
+/*             into an lcov tracefile and exit.               */
+/*                                                            */
+/**************************************************************/
+void cov_merge(char *output, char *program, char *maps[], int num_maps) {
+  LoadResult loaded;
+  int rc, merged;
+
+  init_memory();
+  if ((rc = load_image(program, &loaded)) != LOADER_OK)
+    load_failed(rc, program, &loaded);
+
+  if ((merged = coverage_merge(output, maps, num_maps)) < 0) {
+    printf("Error: Can't write %s\n", output);
+    exit(-1);
+  }
+  printf("Merged %d of %d coverage maps into %s\n", merged, num_maps, output);
+  exit(merged == num_maps ? 0 : 1);
 }
 
 /************************************************************/
@@ -379,42 +1064,221 @@ void load_program(char *program_filename) {
 /*             and set up initial state of the machine.     */
 /*                                                          */
 /************************************************************/
-void initialize(char *program_filename, int num_prog_files) { 
+void initialize(char *program_filenames[], int num_prog_files) {
   int i;
 
   init_memory();
-  for ( i = 0; i < num_prog_files; i++ ) {
-    load_program(program_filename);
-    while(*program_filename++ != '\0');
-  }
+  for ( i = 0; i < num_prog_files; i++ )
+    load_program(program_filenames[i]);
+  mem_set_baseline();
   NEXT_STATE = CURRENT_STATE;
     
   RUN_BIT = TRUE;
 }
 
+/***************************************************************/
+/*                                                             */
+/* Procedure : map_data                                        */
+/*                                                             */
+/* Purpose   : Map a host file into guest memory from a        */
+/*             file@addr[:rw] specification.                   */
+/*                                                             */
+/***************************************************************/
+void map_data(char *spec) {
+  char *at = strrchr(spec, '@');
+  char *end;
+  uint64_t addr;
+  int writable = FALSE;
+
+  if (at == NULL) {
+    printf("Error: Malformed mapping %s (expected file@addr[:rw])\n", spec);
+    exit(-1);
+  }
+
+  *at = '\0';
+  addr = strtoull(at + 1, &end, 0);
+  if (*end == ':' && strcmp(end + 1, "rw") == 0)
+    writable = TRUE;
+  else if (*end != '\0' || end == at + 1) {
+    printf("Error: Malformed mapping %s@%s (expected file@addr[:rw])\n", spec, at + 1);
+    exit(-1);
+  }
+
+  if (mem_map_file(spec, addr, writable) < 0) {
+    printf("Error: Can't map %s at 0x%" PRIx64 ": %s\n", spec, addr,
+           errno == EEXIST ? "overlaps the text, the stack, a device or another file"
+           : errno == EINVAL && (addr & (MEM_PAGE_SIZE - 1)) ? "address is not page aligned"
+           : strerror(errno));
+    exit(-1);
+  }
+
+  if (!ONE_SHOT)
+    printf("Mapped %s at 0x%" PRIx64 " (%s)\n\n", spec, addr,
+           writable ? "shared, read-write" : "private");
+}
+
 /***************************************************************/
 /*                                                             */
 /* Procedure : main                                            */
 /*                                                             */
 /***************************************************************/
 int main(int argc, char *argv[]) {                              
-  FILE * dumpsim_file;
+  FILE * dumpsim_file = NULL;
+  char *console_path = NULL, *dumpsim_path = NULL;
+  char *maps[MEM_MAX_REGIONS];
+  char *script = NULL;
+  int i, num_prog_files = 0, num_maps = 0, timing = FALSE, binary = FALSE;
+  uint64_t timeout_ms = 0;
+  unsigned sample_hz = 0;
+  char *coverage_path = NULL;
+  char *timeline_path = NULL;
+  struct timespec started;
+
+  clock_gettime(CLOCK_MONOTONIC, &started);
+
+  if (argc >= 3 && strcmp(argv[1], "--assemble") == 0) {
+    assemble(argv[2], argc > 3 ? argv[3] : NULL);
+    exit(0);
+  }
+  if (argc >= 3 && strcmp(argv[1], "--dump-text") == 0)
+    dump_text(argv[2], argc > 3 ? argv[3] : NULL);
+  if (argc >= 4 && strcmp(argv[1], "--cov-merge") == 0)
+    cov_merge(argv[2], argv[3], argv + 4, argc - 4);
+
+  /* Options come first; everything else is a program file */
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--console") == 0 && i + 1 < argc)
+      console_path = argv[++i];
+    else if (strcmp(argv[i], "--map-data") == 0 && i + 1 < argc
+             && num_maps < MEM_MAX_REGIONS)
+      maps[num_maps++] = argv[++i];
+    else if (strcmp(argv[i], "--run") == 0)
+      ONE_SHOT = TRUE;
+    else if (strcmp(argv[i], "--dumpsim") == 0 && i + 1 < argc)
+      dumpsim_path = argv[++i];
+    else if (strcmp(argv[i], "--timing") == 0)
+      timing = TRUE;
+    else if (strcmp(argv[i], "--dump-symbols") == 0)
+      dump_symbols = 1;
+    else if (strcmp(argv[i], "--dumpsim-binary") == 0)
+      binary = TRUE;
+    else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc)
+      DUMP_COUNTDOWN = DUMP_EVERY = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--max-insns") == 0 && i + 1 < argc)
+      MAX_INSNS = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--timeout") == 0 && i + 1 < argc)
+      timeout_ms = strtoull(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--detect-loops") == 0)
+      loop_detect = TRUE;
+    else if (strcmp(argv[i], "--profile") == 0) {
+      if (!instrumented(INSTRUMENT_PROF, "--profile"))
+        exit(-1);
+      profile_start();
+    }
+    else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc)
+      sample_hz = strtoul(argv[++i], NULL, 0);
+    else if (strcmp(argv[i], "--plugin") == 0 && i + 1 < argc) {
+      if (!instrumented(INSTRUMENT_TRACE, "--plugin") || plugin_load(argv[++i]) < 0)
+        exit(-1);
+    }
+    else if (strcmp(argv[i], "--timeline") == 0 && i + 1 < argc) {
+      if (!instrumented(INSTRUMENT_TRACE, "--timeline"))
+        exit(-1);
+      timeline_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--history-file") == 0 && i + 1 < argc)
+      history_set_file(argv[++i]);
+    else if (strcmp(argv[i], "--coverage") == 0 && i + 1 < argc) {
+      if (!instrumented(INSTRUMENT_PROF, "--coverage"))
+        exit(-1);
+      coverage_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "--stats") == 0)
+      stats_summary = TRUE;
+    else if (strcmp(argv[i], "--hoststats") == 0) {
+      if (!instrumented(INSTRUMENT_PROF, "--hoststats"))
+        exit(-1);
+      if (hoststat_start(stderr) < 0)
+        fprintf(stderr, "No host counters available; continuing without them\n");
+    }
+    else if (strcmp(argv[i], "--trap") == 0 && i + 1 < argc) {
+      if (trap_parse(argv[++i]) < 0) {
+        printf("Error: Unknown trap policy %s (halt, skip, count, report[=n])\n", argv[i]);
+        exit(1);
+      }
+    }
+    else if ((strcmp(argv[i], "--script") == 0 || strcmp(argv[i], "-e") == 0) && i + 1 < argc) {
+      script = append_script(script, argv[i][1] == 'e' ? argv[i + 1] : read_script(argv[i + 1]));
+      ONE_SHOT = TRUE;
+      i++;
+    }
+    else
+      argv[1 + num_prog_files++] = argv[i];
+  }
+  /* --run only writes a dumpsim file when asked for one */
+  if (dumpsim_path == NULL && (!ONE_SHOT || DUMP_EVERY))
+    dumpsim_path = "dumpsim";
 
   /* Error Checking */
-  if (argc < 2) {
-    printf("Error: usage: %s <program_file_1> <program_file_2> ...\n",
-           argv[0]);
+  if (num_prog_files < 1) {
+    printf("Error: usage: %s [--console file] [--map-data file@addr[:rw]] "
+           "[--run [--timing]] [--script file | -e commands] [--dumpsim file]\n"
+           "       [--dumpsim-binary] [--dump-every n] [--max-insns n] [--timeout ms]\n"
+           "       [--detect-loops] [--trap halt|skip|count|report[=n]] [--profile]\n"
+           "       [--sample-hz n] [--hoststats] [--stats] [--coverage file.cov]\n"
+           "       [--plugin file.so[,args]] [--history-file file]\n"
+           "       [--timeline file.json] [--dump-symbols]\n"
+           "       <program_file_1> <program_file_2> ...\n"
+           "       %s --assemble <file.s> [file.x]\n"
+           "       %s --dump-text <binary dumpsim> [text file]\n"
+           "       %s --cov-merge <out.info> <program_file> <file.cov> ...\n",
+           argv[0], argv[0], argv[0], argv[0]);
     exit(1);
   }
 
-  printf("ARM Simulator\n\n");
+  if (!ONE_SHOT)
+    printf("ARM Simulator\n\n");
+
+  initialize(&argv[1], num_prog_files);
+
+  for (i = 0; i < num_maps; i++)
+    map_data(maps[i]);
 
-  initialize(argv[1], argc - 1);
+  switch (console_init(console_path)) {
+  case -1:
+    printf("Error: Can't open console file %s\n", console_path);
+    exit(-1);
+  case -2:
+    printf("Error: Console device window 0x%x overlaps a mapped region\n", CONSOLE_BASE);
+    exit(-1);
+  }
 
-  if ( (dumpsim_file = fopen( "dumpsim", "w" )) == NULL ) {
+  if (dumpsim_path != NULL && (dumpsim_file = fopen(dumpsim_path, binary ? "wb" : "w")) == NULL) {
     printf("Error: Can't open dumpsim file\n");
     exit(-1);
   }
+  writer_start(dumpsim_file, binary);
+  history_catch_signals();
+
+  if (timeout_ms)
+    watchdog_start(timeout_ms);
+  if (coverage_path != NULL && coverage_start(coverage_path) < 0) {
+    printf("Error: Can't allocate the coverage map\n");
+    exit(-1);
+  }
+  if (timeline_path != NULL && timeline_start(timeline_path) < 0) {
+    printf("Error: Can't open the timeline file\n");
+    exit(-1);
+  }
+  if (sample_hz && sample_start(sample_hz) < 0) {
+    printf("Error: Can't start sampling\n");
+    exit(-1);
+  }
+
+  if (script != NULL)
+    run_script(dumpsim_file, script);
+  if (ONE_SHOT)
+    run_once(dumpsim_file, &started, timing);
 
   while (1)
     get_command(dumpsim_file);
@@ -6,6 +6,10 @@
 #include "shell.h"
 #include "decoder.h"
 #include "executor.h"
+#include "loop.h"
+#include "trap.h"
+#include "history.h"
+#include "instrument.h"
 #include <stdio.h>
 #include <stdint.h>
 
@@ -61,12 +65,20 @@ uint64_t execute_instruction(const Instruction* inst) {
  *        Handles PC updates and ensures XZR register remains zero.
  */
 void process_instruction() {
+    INSTR_BEGIN();
     uint32_t raw = fetch_instruction();
+    INSTR_FETCH();
     Instruction inst = decode_instruction(raw);
+    INSTR_DECODE(&inst);
 
     if (!inst.valid) {
-        printf("Unknown instruction at PC: 0x%lx\n", CURRENT_STATE.PC);
         NEXT_STATE.PC = CURRENT_STATE.PC + 4;
+        trap_unknown(raw);
+        // A halting trap leaves the PC on the word, which never retires.
+        if (trap_stopped)
+            return;
+        history_record(CURRENT_STATE.PC, raw, &inst);
+        INSTR_EXECUTE(&inst, raw, CURRENT_STATE.PC, NEXT_STATE.PC);
         return;
     }
 
@@ -82,6 +94,13 @@ void process_instruction() {
 
     // Ensure register XZR (register 31) is always zero.
     NEXT_STATE.REGS[31] = 0;
+
+    // Loops can only close at a backward branch.
+    if (loop_detect && NEXT_STATE.PC <= CURRENT_STATE.PC)
+        loop_sample();
+
+    history_record(CURRENT_STATE.PC, raw, &inst);
+    INSTR_EXECUTE(&inst, raw, CURRENT_STATE.PC, NEXT_STATE.PC);
 }
 
 // final version
\ No newline at end of file
@@ -0,0 +1,279 @@
+/**
+ * @file snapshot.c
+ * @brief Machine state snapshots and a vectorized state diff.
+ */
+
+#include "snapshot.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#define DIFF_GAP 16   ///< Equal bytes needed to close a differing range
+
+static const Snapshot *latest;   ///< Reference point of the MEM_DIRTY_SNAP flags
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * BUFFER SCANNING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Portable scan, one 64-bit word at a time.
+ */
+static uint64_t first_diff_scalar(const uint8_t *a, const uint8_t *b, uint64_t n) {
+    uint64_t i = 0;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x, y;
+        memcpy(&x, a + i, 8);
+        memcpy(&y, b + i, 8);
+        if (x != y)
+            return i + (__builtin_ctzll(x ^ y) >> 3);
+    }
+#endif
+    for (; i < n; i++) {
+        if (a[i] != b[i])
+            return i;
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+/**
+ * @brief AVX2 scan: 128 bytes per step while equal, then 32-byte compares
+ *        to pinpoint the first differing byte.
+ */
+__attribute__((target("avx2")))
+static uint64_t first_diff_avx2(const uint8_t *a, const uint8_t *b, uint64_t n) {
+    uint64_t i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        __m256i x0 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m256i x1 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 32)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+        __m256i x2 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 64)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 64)));
+        __m256i x3 = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *) (a + i + 96)),
+                                      _mm256_loadu_si256((const __m256i *) (b + i + 96)));
+        __m256i any = _mm256_or_si256(_mm256_or_si256(x0, x1), _mm256_or_si256(x2, x3));
+        if (!_mm256_testz_si256(any, any))
+            break;
+    }
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i eq = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *) (a + i)),
+                                       _mm256_loadu_si256((const __m256i *) (b + i)));
+        uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(eq);
+        if (mask)
+            return i + __builtin_ctz(mask);
+    }
+
+    return i + first_diff_scalar(a + i, b + i, n - i);
+}
+#endif
+
+/**
+ * @brief Offset of the first byte where two buffers differ, using AVX2
+ *        when the host has it.
+ */
+uint64_t mem_first_diff(const uint8_t *a, const uint8_t *b, uint64_t n) {
+#if defined(__x86_64__)
+    static int has_avx2 = -1;
+    if (has_avx2 < 0)
+        has_avx2 = __builtin_cpu_supports("avx2");
+    if (has_avx2)
+        return first_diff_avx2(a, b, n);
+#endif
+    return first_diff_scalar(a, b, n);
+}
+
+/**
+ * @brief Reports the differing ranges between from and to, coalescing
+ *        differences separated by fewer than DIFF_GAP equal bytes.
+ */
+static int diff_span(const SnapshotRegion *ra, const SnapshotRegion *rb,
+                     uint64_t from, uint64_t to, FILE *out) {
+    int ranges = 0;
+    uint64_t off = from;
+
+    while (off < to) {
+        uint64_t d = off + mem_first_diff(ra->mem + off, rb->mem + off, to - off);
+        if (d >= to)
+            break;
+
+        uint64_t e = d + 1;
+        while (e < to) {
+            uint64_t n = to - e < DIFF_GAP ? to - e : DIFF_GAP;
+            uint64_t k = mem_first_diff(ra->mem + e, rb->mem + e, n);
+            if (k == n)
+                break;
+            e += k + 1;
+        }
+
+        uint64_t lo = d & ~3ull;
+        uint64_t hi = (e + 3) & ~3ull;
+        if (hi > ra->size)
+            hi = ra->size;
+        if (out)
+            fprintf(out, "  0x%08" PRIx64 "..0x%08" PRIx64 " (%" PRIu64 " bytes)\n",
+                    ra->start + lo, ra->start + hi - 1, hi - lo);
+        ranges++;
+        off = e;
+    }
+    return ranges;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * SNAPSHOTS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Copies the current machine state into a snapshot.
+ */
+void snapshot_take(Snapshot *s) {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        SnapshotRegion *r = &s->regions[i];
+        if (i >= s->nregions || r->start != MEM_REGIONS[i].start ||
+                r->size != MEM_REGIONS[i].size) {
+            if (i < s->nregions)
+                free(r->mem);
+            r->mem = malloc(MEM_REGIONS[i].size);
+        }
+        r->start = MEM_REGIONS[i].start;
+        r->size = MEM_REGIONS[i].size;
+        r->dirty = NULL;
+        memcpy(r->mem, MEM_REGIONS[i].mem, r->size);
+    }
+    for (; i < s->nregions; i++)
+        free(s->regions[i].mem);
+
+    s->nregions = MEM_NREGIONS;
+    s->cpu = CURRENT_STATE;
+    s->icount = INSTRUCTION_COUNT;
+    s->live = 0;
+
+    mem_clear_dirty(MEM_DIRTY_SNAP);
+    latest = s;
+}
+
+/**
+ * @brief Fills a snapshot that views the running machine without copying.
+ */
+void snapshot_live(Snapshot *s) {
+    int i;
+
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        s->regions[i].start = MEM_REGIONS[i].start;
+        s->regions[i].size = MEM_REGIONS[i].size;
+        s->regions[i].mem = MEM_REGIONS[i].mem;
+        s->regions[i].dirty = MEM_REGIONS[i].dirty;
+    }
+    s->nregions = MEM_NREGIONS;
+    s->cpu = CURRENT_STATE;
+    s->icount = INSTRUCTION_COUNT;
+    s->live = 1;
+}
+
+/**
+ * @brief Releases the buffers owned by a snapshot.
+ */
+void snapshot_free(Snapshot *s) {
+    int i;
+
+    if (!s->live) {
+        for (i = 0; i < s->nregions; i++)
+            free(s->regions[i].mem);
+    }
+    if (latest == s)
+        latest = NULL;
+    s->nregions = 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * DIFF
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Compares two machine states and reports what differs.
+ */
+int snapshot_diff(const Snapshot *a, const Snapshot *b, FILE *out) {
+    int k, i, diffs = 0;
+
+    // Live-vs-latest only needs the pages written since that snapshot.
+    const Snapshot *live = a->live ? a : (b->live ? b : NULL);
+    int filtered = live && (a == latest || b == latest);
+
+    if (out)
+        fprintf(out, "State differences (instruction %" PRIu64 " vs %" PRIu64 ") :\n",
+                a->icount, b->icount);
+
+    if (a->cpu.PC != b->cpu.PC) {
+        if (out)
+            fprintf(out, "  PC: 0x%" PRIx64 " -> 0x%" PRIx64 "\n", a->cpu.PC, b->cpu.PC);
+        diffs++;
+    }
+    for (k = 0; k < ARM_REGS; k++) {
+        if (a->cpu.REGS[k] == b->cpu.REGS[k])
+            continue;
+        if (out)
+            fprintf(out, "  X%d: 0x%" PRIx64 " -> 0x%" PRIx64 "\n", k,
+                    a->cpu.REGS[k], b->cpu.REGS[k]);
+        diffs++;
+    }
+    if (a->cpu.FLAG_N != b->cpu.FLAG_N || a->cpu.FLAG_Z != b->cpu.FLAG_Z) {
+        if (out)
+            fprintf(out, "  FLAGS: N=%d Z=%d -> N=%d Z=%d\n", a->cpu.FLAG_N,
+                    a->cpu.FLAG_Z, b->cpu.FLAG_N, b->cpu.FLAG_Z);
+        diffs++;
+    }
+
+    for (i = 0; i < a->nregions; i++) {
+        const SnapshotRegion *ra = &a->regions[i];
+        const SnapshotRegion *rb = NULL;
+        for (k = 0; k < b->nregions; k++) {
+            if (b->regions[k].start == ra->start && b->regions[k].size == ra->size)
+                rb = &b->regions[k];
+        }
+        if (rb == NULL) {
+            if (out)
+                fprintf(out, "  region 0x%08" PRIx64 " missing from second state\n",
+                        ra->start);
+            diffs++;
+            continue;
+        }
+
+        if (!filtered) {
+            diffs += diff_span(ra, rb, 0, ra->size, out);
+            continue;
+        }
+
+        const uint8_t *dirty = (live == a ? ra : rb)->dirty;
+        uint64_t npages = (ra->size + MEM_PAGE_SIZE - 1) >> MEM_PAGE_SHIFT;
+        uint64_t p = 0;
+        while (p < npages) {
+            if (!(dirty[p] & MEM_DIRTY_SNAP)) {
+                p++;
+                continue;
+            }
+            uint64_t first = p;
+            while (p < npages && (dirty[p] & MEM_DIRTY_SNAP))
+                p++;
+            uint64_t end = p << MEM_PAGE_SHIFT;
+            diffs += diff_span(ra, rb, first << MEM_PAGE_SHIFT,
+                               end < ra->size ? end : ra->size, out);
+        }
+    }
+
+    if (out)
+        fprintf(out, "%d difference%s\n\n", diffs, diffs == 1 ? "" : "s");
+    return diffs;
+}
+
+// final version
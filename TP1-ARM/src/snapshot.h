@@ -0,0 +1,79 @@
+/**
+ * @file snapshot.h
+ * @brief Machine state snapshots and a vectorized state diff.
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "shell.h"
+#include "memory.h"
+
+/**
+ * @struct SnapshotRegion
+ * @brief Contents of one guest memory region.
+ */
+typedef struct {
+    uint64_t start, size;
+    uint8_t *mem;             ///< Region bytes (owned unless the snapshot is live)
+    const uint8_t *dirty;     ///< Live only: the region's dirty-page map
+} SnapshotRegion;
+
+/**
+ * @struct Snapshot
+ * @brief Architectural state: registers, flags, PC and every memory region.
+ */
+typedef struct {
+    CPU_State cpu;
+    uint64_t icount;
+    int nregions;
+    SnapshotRegion regions[MEM_MAX_REGIONS];
+    int live;                 ///< Views the running machine instead of owning copies
+} Snapshot;
+
+/**
+ * @brief Copies the current machine state into a snapshot. Buffers from a
+ *        previous take are reused when the region layout is unchanged.
+ *
+ * @param s Snapshot to fill (zero-initialize before the first take).
+ */
+void snapshot_take(Snapshot *s);
+
+/**
+ * @brief Fills a snapshot that views the running machine without copying.
+ *
+ * Diffing it against the most recently taken snapshot only scans pages
+ * written since that take.
+ *
+ * @param s Snapshot to fill.
+ */
+void snapshot_live(Snapshot *s);
+
+/**
+ * @brief Releases the buffers owned by a snapshot.
+ */
+void snapshot_free(Snapshot *s);
+
+/**
+ * @brief Compares two machine states and reports differing registers and
+ *        memory ranges.
+ *
+ * @param a   First state.
+ * @param b   Second state.
+ * @param out Report destination, or NULL to only count.
+ * @return int Number of differing registers plus differing memory ranges.
+ */
+int snapshot_diff(const Snapshot *a, const Snapshot *b, FILE *out);
+
+/**
+ * @brief Offset of the first byte where two buffers differ.
+ *
+ * @return uint64_t Offset, or n if the buffers are equal.
+ */
+uint64_t mem_first_diff(const uint8_t *a, const uint8_t *b, uint64_t n);
+
+#endif // SNAPSHOT_H
+
+// final version
@@ -0,0 +1,182 @@
+/**
+ * @file stats.c
+ * @brief Simulator throughput: retired instructions, host time and MIPS.
+ */
+
+#include "stats.h"
+#include "shell.h"
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+
+#define STATS_BUCKETS (61 * STATS_SUB_BUCKETS)   ///< Covers every 64-bit value
+#define STATS_BAR 40                               ///< Width of the longest bar
+
+int stats_summary;
+
+static uint64_t histogram[STATS_BUCKETS];
+static uint64_t slices, slice_min, slice_max;
+static uint64_t slice_ns, slice_start;   ///< Time in and first instruction of the open slice
+static uint64_t run_ns, run_insns;       ///< Totals since reset
+static uint64_t last_ns, last_insns;     ///< The last run
+static uint64_t mark_ns, begin_icount;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * HISTOGRAM
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Bucket of a value: exact below STATS_SUB_BUCKETS, then the top
+ *        four bits after the leading one.
+ */
+static int bucket_of(uint64_t v) {
+    int e;
+
+    if (v < STATS_SUB_BUCKETS)
+        return (int) v;
+    e = 63 - __builtin_clzll(v);
+    return (e - 3) * STATS_SUB_BUCKETS + (int) ((v >> (e - 4)) & (STATS_SUB_BUCKETS - 1));
+}
+
+/**
+ * @brief Smallest value that falls in bucket i.
+ */
+static uint64_t bucket_low(int i) {
+    int e = i / STATS_SUB_BUCKETS + 3, sub = i % STATS_SUB_BUCKETS;
+
+    if (i < STATS_SUB_BUCKETS)
+        return (uint64_t) i;
+    return (uint64_t) (STATS_SUB_BUCKETS + sub) << (e - 4);
+}
+
+static void record(uint64_t ns) {
+    histogram[bucket_of(ns)]++;
+    if (slices == 0 || ns < slice_min)
+        slice_min = ns;
+    if (ns > slice_max)
+        slice_max = ns;
+    slices++;
+}
+
+/**
+ * @brief Highest value of the bucket holding the given fraction of slices.
+ */
+static uint64_t percentile(double p) {
+    uint64_t want = (uint64_t) (p * slices + 0.999999), seen = 0;
+    int i;
+
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= want && seen > 0) {
+            uint64_t high = i + 1 < STATS_BUCKETS ? bucket_low(i + 1) - 1 : UINT64_MAX;
+            return high < slice_max ? high : slice_max;
+        }
+    }
+    return slice_max;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * TIMING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void stats_begin() {
+    mark_ns = now_ns();
+    begin_icount = INSTRUCTION_COUNT;
+    last_ns = 0;
+}
+
+uint64_t stats_slice_left() {
+    return STATS_SLICE - INSTRUCTION_COUNT % STATS_SLICE;
+}
+
+void stats_batch() {
+    uint64_t now = now_ns();
+
+    slice_ns += now - mark_ns;
+    last_ns += now - mark_ns;
+    mark_ns = now;
+
+    // Only whole slices are recorded: a run that started part way into
+    // one, after a reset or a register change, still counts towards it.
+    if (INSTRUCTION_COUNT % STATS_SLICE == 0 && INSTRUCTION_COUNT != slice_start) {
+        record(slice_ns);
+        slice_ns = 0;
+        slice_start = INSTRUCTION_COUNT;
+    }
+}
+
+void stats_end() {
+    stats_batch();
+    last_insns = INSTRUCTION_COUNT - begin_icount;
+    run_ns += last_ns;
+    run_insns += last_insns;
+}
+
+static double mips(uint64_t insns, uint64_t ns) {
+    return ns ? insns * 1e3 / ns : 0.0;
+}
+
+void stats_last_run(FILE *out) {
+    fprintf(out, "Retired %" PRIu64 " instructions in %.3f s (%.2f MIPS)\n\n",
+            last_insns, last_ns / 1e9, mips(last_insns, last_ns));
+}
+
+void stats_reset() {
+    memset(histogram, 0, sizeof(histogram));
+    slices = slice_min = slice_max = 0;
+    slice_ns = slice_start = 0;
+    run_ns = run_insns = last_ns = last_insns = 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * REPORT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void stats_report(FILE *out) {
+    static const double PERCENTILES[] = { 0.5, 0.9, 0.99, 0.999 };
+    uint64_t peak = 0;
+    int i, j;
+
+    fprintf(out, "Instructions retired : %" PRIu64 "\n", INSTRUCTION_COUNT);
+    fprintf(out, "Host time            : %.3f s\n", run_ns / 1e9);
+    fprintf(out, "Guest MIPS           : %.2f\n", mips(run_insns, run_ns));
+    fprintf(out, "Last run             : %" PRIu64 " instructions, %.3f s, %.2f MIPS\n\n",
+            last_insns, last_ns / 1e9, mips(last_insns, last_ns));
+
+    if (slices == 0) {
+        fprintf(out, "No complete %d-instruction slice yet\n\n", STATS_SLICE);
+        return;
+    }
+
+    fprintf(out, "Host time per %d-instruction slice (%" PRIu64 " slices), ms:\n",
+            STATS_SLICE, slices);
+    fprintf(out, "  min %.3f", slice_min / 1e6);
+    for (i = 0; i < (int) (sizeof(PERCENTILES) / sizeof(PERCENTILES[0])); i++)
+        fprintf(out, "  p%g %.3f", PERCENTILES[i] * 100, percentile(PERCENTILES[i]) / 1e6);
+    fprintf(out, "  max %.3f\n\n", slice_max / 1e6);
+
+    for (i = 0; i < STATS_BUCKETS; i++)
+        if (histogram[i] > peak)
+            peak = histogram[i];
+    for (i = 0; i < STATS_BUCKETS; i++) {
+        int width = (int) ((histogram[i] * STATS_BAR + peak - 1) / peak);
+
+        if (histogram[i] == 0)
+            continue;
+        fprintf(out, "  %10.3f .. %10.3f %10" PRIu64 " ", bucket_low(i) / 1e6,
+                bucket_low(i + 1) / 1e6, histogram[i]);
+        for (j = 0; j < width; j++)
+            fputc('#', out);
+        fputc('\n', out);
+    }
+    fprintf(out, "\n");
+}
+
+// final version
@@ -0,0 +1,68 @@
+/**
+ * @file stats.h
+ * @brief Simulator throughput: retired instructions, host time and MIPS.
+ *
+ * simulate() brackets every run with stats_begin() and stats_end() and
+ * cuts its batches at multiples of STATS_SLICE instructions, so the host
+ * time of each slice can be read from the clock after a batch and nothing
+ * is added to cycle(). Slice times go into a log-linear histogram in the
+ * style of HdrHistogram: STATS_SUB_BUCKETS buckets per power of two, so
+ * any recorded value is within about 6% of its bucket's bounds. Time spent
+ * waiting at the shell prompt is not counted.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define STATS_SLICE 1000000     ///< Instructions per histogram sample
+#define STATS_SUB_BUCKETS 16    ///< Histogram buckets per power of two
+
+/**
+ * @brief Prints a one-line summary after every run when set (--stats).
+ */
+extern int stats_summary;
+
+/**
+ * @brief Starts the clock for a run.
+ */
+void stats_begin();
+
+/**
+ * @brief Instructions left before the current slice ends; simulate() keeps
+ *        its batches from crossing that point.
+ */
+uint64_t stats_slice_left();
+
+/**
+ * @brief Charges the time since the last call to the current slice and
+ *        records the slice if INSTRUCTION_COUNT has reached its end.
+ */
+void stats_batch();
+
+/**
+ * @brief Stops the clock and adds the run to the totals.
+ */
+void stats_end();
+
+/**
+ * @brief Prints the instructions, host time and MIPS of the last run.
+ */
+void stats_last_run(FILE *out);
+
+/**
+ * @brief Forgets every run and slice.
+ */
+void stats_reset();
+
+/**
+ * @brief Prints the totals since the last reset, the last run and the
+ *        slice time histogram with its percentiles.
+ */
+void stats_report(FILE *out);
+
+#endif // STATS_H
+
+// final version
@@ -0,0 +1,271 @@
+/**
+ * @file timeline.c
+ * @brief Timeline of the guest run in the Chrome trace-event JSON format.
+ */
+
+#include "timeline.h"
+#include "shell.h"
+#include "memory.h"
+#include "loader.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+
+#define TIMELINE_EVENT 512   ///< Room kept in the buffer for one event
+#define TIMELINE_NAME  96    ///< Longest slice name
+
+/**
+ * @struct Slice
+ * @brief A block, or a loop once iterations is set.
+ */
+typedef struct {
+    uint64_t head;         ///< First instruction; for a loop, its branch target
+    uint64_t low, tail;    ///< Lowest and highest instruction covered
+    uint64_t ts, dur;      ///< In instructions
+    uint64_t iterations;   ///< Times the head was entered; 0 for a block
+} Slice;
+
+int timelining;
+
+static FILE *trace;
+static char buffer[TIMELINE_BUFFER];
+static size_t used;
+
+static uint64_t clock_base;   ///< Instructions retired before the last reset
+static uint64_t clock_now;    ///< Timestamp after the last retired instruction
+
+static Slice pending[TIMELINE_PENDING];
+static unsigned first, npending;
+static Slice loop;
+static int in_loop, in_block;
+static uint64_t block_head, block_ts;
+
+static uint64_t accesses[MEM_MAX_REGIONS], shown[MEM_MAX_REGIONS];
+static uint64_t window_end = TIMELINE_WINDOW;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * OUTPUT
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void flush_buffer() {
+    if (used > 0)
+        fwrite(buffer, 1, used, trace);
+    used = 0;
+}
+
+static void emit(const char *format, ...) {
+    va_list ap;
+    int n;
+
+    if (used > TIMELINE_BUFFER - TIMELINE_EVENT)
+        flush_buffer();
+    va_start(ap, format);
+    n = vsnprintf(buffer + used, TIMELINE_BUFFER - used, format, ap);
+    va_end(ap);
+    if (n > 0)
+        used += (size_t) n < TIMELINE_BUFFER - used ? (size_t) n : TIMELINE_BUFFER - used - 1;
+}
+
+/**
+ * @brief The symbol-relative name of addr, safe inside a JSON string.
+ */
+static void location(char *name, size_t size, uint64_t addr) {
+    const Symbol *s = symbol_lookup(addr);
+    char *p;
+
+    if (s == NULL)
+        snprintf(name, size, "0x%" PRIx64, addr);
+    else if (addr == s->addr)
+        snprintf(name, size, "%s", s->name);
+    else
+        snprintf(name, size, "%s+0x%" PRIx64, s->name, addr - s->addr);
+    for (p = name; *p; p++)
+        if (*p == '"' || *p == '\\' || (unsigned char) *p < ' ')
+            *p = '_';
+}
+
+static void emit_slice(const Slice *s) {
+    char name[TIMELINE_NAME];
+
+    location(name, sizeof(name), s->head);
+    if (s->iterations)
+        emit(",\n{\"name\":\"loop %s\",\"cat\":\"loop\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+             "\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"args\":{\"head\":\"0x%" PRIx64 "\","
+             "\"tail\":\"0x%" PRIx64 "\",\"iterations\":%" PRIu64 "}}",
+             name, s->ts, s->dur, s->head, s->tail, s->iterations);
+    else
+        emit(",\n{\"name\":\"%s\",\"cat\":\"block\",\"ph\":\"X\",\"pid\":1,\"tid\":1,"
+             "\"ts\":%" PRIu64 ",\"dur\":%" PRIu64 ",\"args\":{\"pc\":\"0x%" PRIx64 "\"}}",
+             name, s->ts, s->dur, s->head);
+}
+
+/**
+ * @brief Ends the counter window that started at ts; a sample is written
+ *        only when some region's count changed.
+ */
+static void emit_counters(uint64_t ts) {
+    int i, changed = 0;
+
+    for (i = 0; i < MEM_NREGIONS; i++)
+        changed |= accesses[i] != shown[i];
+    if (!changed)
+        return;
+
+    emit(",\n{\"name\":\"memory accesses per %d instructions\",\"ph\":\"C\",\"pid\":1,"
+         "\"ts\":%" PRIu64 ",\"args\":{", TIMELINE_WINDOW, ts);
+    for (i = 0; i < MEM_NREGIONS; i++) {
+        emit("%s\"0x%" PRIx64 "\":%" PRIu64, i ? "," : "", MEM_REGIONS[i].start, accesses[i]);
+        shown[i] = accesses[i];
+    }
+    emit("}}");
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * COALESCING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static Slice *pending_at(unsigned i) {
+    return &pending[(first + i) % TIMELINE_PENDING];
+}
+
+static void push(const Slice *s) {
+    if (npending == TIMELINE_PENDING) {
+        emit_slice(pending_at(0));
+        first = (first + 1) % TIMELINE_PENDING;
+        npending--;
+    }
+    *pending_at(npending++) = *s;
+}
+
+static void flush_pending() {
+    while (npending > 0) {
+        emit_slice(pending_at(0));
+        first = (first + 1) % TIMELINE_PENDING;
+        npending--;
+    }
+}
+
+/**
+ * @brief Turns the newest held-back slice that covers head, and the ones
+ *        after it, into a loop from head to the branch at tail.
+ */
+static void collapse(uint64_t head, uint64_t tail) {
+    unsigned i = npending, j;
+    Slice *s;
+
+    while (i > 0 && (head < pending_at(i - 1)->low || head > pending_at(i - 1)->tail))
+        i--;
+    if (i == 0)
+        return;
+    s = pending_at(i - 1);
+    // Coming back to the head of a loop that just ended is one more pass of it.
+    loop = (Slice) { head, s->low, tail, s->ts, 0, s->iterations && s->head == head ? s->iterations + 1 : 2 };
+    for (j = i - 1; j < npending; j++) {
+        if (pending_at(j)->low < loop.low)
+            loop.low = pending_at(j)->low;
+        if (pending_at(j)->tail > loop.tail)
+            loop.tail = pending_at(j)->tail;
+    }
+    npending = i - 1;
+    in_loop = 1;
+}
+
+/**
+ * @brief Handles the end of the block whose last instruction is at pc.
+ */
+static void block_end(uint64_t pc, uint64_t next) {
+    Slice block = { block_head, block_head, pc, block_ts, clock_now - block_ts, 0 };
+
+    in_block = 0;
+    if (in_loop) {
+        if (next >= loop.low && next <= loop.tail) {
+            loop.iterations += next == loop.head;
+            return;
+        }
+        loop.dur = clock_now - loop.ts;
+        push(&loop);
+        in_loop = 0;
+    } else {
+        push(&block);
+    }
+    if (next <= pc)
+        collapse(next, pc);
+}
+
+/**
+ * @brief Ends whatever is open at the current timestamp.
+ */
+static void close_all() {
+    if (in_loop) {
+        loop.dur = clock_now - loop.ts;
+        push(&loop);
+        in_loop = 0;
+    } else if (in_block) {
+        Slice block = { block_head, block_head, block_head, block_ts, clock_now - block_ts, 0 };
+        push(&block);
+    }
+    in_block = 0;
+    flush_pending();
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * RECORDING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+void timeline_retire(const Instruction *inst, uint64_t pc, uint64_t next) {
+    uint64_t now = clock_base + INSTRUCTION_COUNT;
+    int i;
+
+    if (now >= window_end) {
+        emit_counters(window_end - TIMELINE_WINDOW);
+        memset(accesses, 0, sizeof(accesses));
+        window_end = now + TIMELINE_WINDOW;
+    }
+    if (!in_block) {
+        block_head = pc;
+        block_ts = now;
+        in_block = 1;
+    }
+    clock_now = now + 1;
+
+    if (inst->valid && (strncmp(inst->name, "LDUR", 4) == 0 || strncmp(inst->name, "STUR", 4) == 0)) {
+        uint64_t addr = CURRENT_STATE.REGS[inst->Rn] + inst->imm;
+
+        for (i = 0; i < MEM_NREGIONS; i++)
+            if (addr - MEM_REGIONS[i].start < MEM_REGIONS[i].size) {
+                accesses[i]++;
+                break;
+            }
+    }
+
+    if (next != pc + 4 || inst_ends_block(inst))
+        block_end(pc, next);
+}
+
+static void timeline_finish() {
+    close_all();
+    emit_counters(window_end - TIMELINE_WINDOW);
+    emit("\n]\n");
+    flush_buffer();
+    fclose(trace);
+}
+
+int timeline_start(const char *path) {
+    if ((trace = fopen(path, "w")) == NULL)
+        return -1;
+    emit("[\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"guest\"}}");
+    atexit(timeline_finish);
+    timelining = 1;
+    return 0;
+}
+
+void timeline_reset() {
+    if (!timelining)
+        return;
+    close_all();
+    clock_base = clock_now;
+}
+
+// final version
@@ -0,0 +1,68 @@
+/**
+ * @file timeline.h
+ * @brief Timeline of the guest run in the Chrome trace-event JSON format.
+ *
+ * The file holds one complete ("X") slice per guest basic block, on a
+ * single track, and opens in chrome://tracing and the Perfetto UI.
+ * Timestamps are retired-instruction counts: one microsecond on the
+ * viewer's axis is one instruction, and the count keeps growing across
+ * resets so runs follow each other.
+ *
+ * Repeated iterations are coalesced. The last TIMELINE_PENDING slices are
+ * held back; when a backward branch lands inside one of them, that slice
+ * and everything after it become one "loop" slice, which stays open for
+ * as long as control stays within the instructions those slices covered.
+ * Inner loops are folded into the outer one the same way, so a loop of a
+ * billion iterations is one event. A loop entered by falling into it
+ * starts with the block that led there.
+ *
+ * Every TIMELINE_WINDOW instructions a counter ("C") event gives the loads
+ * and stores that hit each memory region in that window, when they
+ * changed. Events are formatted into a TIMELINE_BUFFER byte buffer and
+ * written out as it fills. The file is a JSON array, which the viewers
+ * accept even when the closing bracket is missing after a crash.
+ */
+
+#ifndef TIMELINE_H
+#define TIMELINE_H
+
+#include "decoder.h"
+#include <stdint.h>
+
+#define TIMELINE_BUFFER  (1 << 16)  ///< Bytes formatted before a write
+#define TIMELINE_PENDING 64         ///< Slices held back for coalescing
+#define TIMELINE_WINDOW  10000      ///< Instructions per memory counter sample
+
+/**
+ * @brief Enables the timeline. Checked by process_instruction() before
+ *        calling timeline_retire().
+ */
+extern int timelining;
+
+/**
+ * @brief Opens the trace file and starts the timeline; the file is
+ *        completed when the simulator exits.
+ *
+ * @return int 0 on success, -1 if the file could not be opened.
+ */
+int timeline_start(const char *path);
+
+/**
+ * @brief Adds one retired instruction, before CURRENT_STATE moves on.
+ *
+ * @param inst Decoded instruction; its base register gives the address of
+ *             a load or store.
+ * @param pc   Address it was fetched from.
+ * @param next Address of the next instruction.
+ */
+void timeline_retire(const Instruction *inst, uint64_t pc, uint64_t next);
+
+/**
+ * @brief Ends the open slices at a machine reset. Later timestamps carry
+ *        on from the last one rather than from zero.
+ */
+void timeline_reset();
+
+#endif // TIMELINE_H
+
+// final version
@@ -0,0 +1,100 @@
+/**
+ * @file trap.c
+ * @brief Handling of instructions the decoder does not recognize.
+ */
+
+#include "trap.h"
+#include "shell.h"
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+
+/**
+ * @struct Trap
+ * @brief Where a trap happened and the word that caused it.
+ */
+typedef struct {
+    uint64_t pc;
+    uint32_t raw;
+} Trap;
+
+int trap_policy = TRAP_REPORT;
+uint64_t trap_limit = TRAP_REPORT_DEFAULT;
+uint64_t trap_count;
+int trap_pending;
+int trap_stopped;
+
+static Trap pending[TRAP_PENDING];
+static uint64_t summarized;       ///< trap_count at the last summary
+static Trap last;
+
+int trap_parse(const char *spec) {
+    char *end;
+
+    if (strcmp(spec, "halt") == 0)
+        trap_policy = TRAP_HALT;
+    else if (strcmp(spec, "skip") == 0)
+        trap_policy = TRAP_SKIP;
+    else if (strcmp(spec, "count") == 0)
+        trap_policy = TRAP_COUNT;
+    else if (strcmp(spec, "report") == 0)
+        trap_policy = TRAP_REPORT;
+    else if (strncmp(spec, "report=", 7) == 0) {
+        trap_policy = TRAP_REPORT;
+        trap_limit = strtoull(spec + 7, &end, 0);
+        if (*end != '\0' || end == spec + 7)
+            return -1;
+    } else
+        return -1;
+    return 0;
+}
+
+void trap_unknown(uint32_t raw) {
+    last.pc = CURRENT_STATE.PC;
+    last.raw = raw;
+
+    if (trap_policy == TRAP_HALT) {
+        NEXT_STATE.PC = CURRENT_STATE.PC;
+        trap_stopped = TRUE;
+        RUN_BIT = FALSE;
+    }
+    // A halting trap is reported by trap_report_halt() instead.
+    if (trap_policy == TRAP_REPORT && trap_count < trap_limit && trap_pending < TRAP_PENDING)
+        pending[trap_pending++] = last;
+    trap_count++;
+}
+
+void trap_flush(FILE *out) {
+    int i;
+
+    for (i = 0; i < trap_pending; i++)
+        fprintf(out, "Unknown instruction at PC: 0x%" PRIx64 "\n", pending[i].pc);
+    trap_pending = 0;
+}
+
+void trap_summary(FILE *out) {
+    uint64_t unreported;
+
+    if (trap_count == summarized)
+        return;
+
+    if (trap_policy == TRAP_COUNT)
+        fprintf(out, "%" PRIu64 " unknown instructions skipped\n", trap_count - summarized);
+    else if (trap_policy == TRAP_REPORT && trap_count > trap_limit) {
+        unreported = trap_count - (summarized > trap_limit ? summarized : trap_limit);
+        fprintf(out, "%" PRIu64 " more unknown instructions not reported\n", unreported);
+    }
+    summarized = trap_count;
+}
+
+void trap_report_halt(FILE *out) {
+    fprintf(out, "Stopped: unknown instruction 0x%08x at PC 0x%" PRIx64 "\n\n", last.raw, last.pc);
+}
+
+void trap_reset() {
+    trap_count = summarized = 0;
+    trap_pending = 0;
+    trap_stopped = FALSE;
+}
+
+// final version
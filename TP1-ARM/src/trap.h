@@ -0,0 +1,78 @@
+/**
+ * @file trap.h
+ * @brief Handling of instructions the decoder does not recognize.
+ *
+ * The core only counts a trap and, for reports, appends it to a small
+ * pending buffer. Messages are printed by the shell between batches of
+ * cycles, so a guest running through data or zeroed memory never does
+ * I/O per instruction.
+ */
+
+#ifndef TRAP_H
+#define TRAP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRAP_REPORT 0   ///< Print the first trap_limit traps, count the rest
+#define TRAP_COUNT  1   ///< Count, and print a total after each run
+#define TRAP_SKIP   2   ///< Count silently
+#define TRAP_HALT   3   ///< Stop the machine on the trapping instruction
+
+#define TRAP_REPORT_DEFAULT 100   ///< Reports printed before counting silently
+#define TRAP_PENDING 4096         ///< Reports held between two flushes
+
+extern int trap_policy;
+extern uint64_t trap_limit;       ///< TRAP_REPORT: number of traps printed
+extern uint64_t trap_count;       ///< Traps since the last reset
+extern int trap_pending;          ///< Reports waiting for trap_flush()
+
+/**
+ * @brief Set when a TRAP_HALT trap cleared RUN_BIT, so the run loop can
+ *        tell it from a real halt.
+ */
+extern int trap_stopped;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FUNCTION DECLARATIONS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Parses a policy: halt, skip, count, report or report=N.
+ *
+ * @return int 0 on success, -1 if the policy is not understood.
+ */
+int trap_parse(const char *spec);
+
+/**
+ * @brief Called by the core when an instruction fails to decode, after
+ *        NEXT_STATE.PC has been set past it. Does no I/O.
+ *
+ * @param raw The undecodable word.
+ */
+void trap_unknown(uint32_t raw);
+
+/**
+ * @brief Prints the pending reports.
+ */
+void trap_flush(FILE *out);
+
+/**
+ * @brief Prints what happened to the traps that were not reported, once
+ *        a run has ended.
+ */
+void trap_summary(FILE *out);
+
+/**
+ * @brief Describes the trap that set trap_stopped.
+ */
+void trap_report_halt(FILE *out);
+
+/**
+ * @brief Clears the counters (on reset).
+ */
+void trap_reset();
+
+#endif // TRAP_H
+
+// final version
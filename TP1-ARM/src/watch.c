@@ -0,0 +1,248 @@
+/**
+ * @file watch.c
+ * @brief Data watchpoints implemented with host page protection.
+ *
+ * The host page holding a watched range is protected (PROT_NONE for read
+ * watches, PROT_READ for write-only ones). An access to that page faults
+ * into a SIGSEGV handler that unprotects it, snapshots the watched bytes
+ * and flags the cycle. After the instruction retires the shell calls
+ * watch_after_cycle(), which compares the range, reports a hit and
+ * protects the page again. Accesses to every other page run untouched.
+ *
+ * A page is only opened once per instruction, so a read is matched against
+ * everything the instruction reads, worked out from the instruction and
+ * the registers it started with, not against the address that faulted.
+ */
+
+#include "watch.h"
+#include "shell.h"
+#include "memory.h"
+#include "history.h"
+#include "decoder.h"
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * WATCHPOINT TABLE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+typedef struct {
+    uint64_t addr, len;           ///< Watched guest range
+    int mode;                     ///< WATCH_READ | WATCH_WRITE
+    uint8_t *host;                ///< Host location of addr
+    uintptr_t page_lo, page_hi;   ///< Host pages covering the range [lo, hi)
+    int touched;                  ///< Page faulted during this cycle
+    uint64_t pc;                  ///< PC of the faulting instruction
+    uint8_t old[WATCH_MAX_LEN];   ///< Range contents before the access
+} Watchpoint;
+
+static Watchpoint watches[WATCH_MAX];
+static int nwatches;
+static int suspended;
+static uintptr_t page_size;
+
+volatile sig_atomic_t watch_pending;
+int watch_stopped;
+
+static int64_t fault_regs[ARM_REGS];   ///< Registers before the faulting instruction
+
+/**
+ * @brief Strongest protection required by any watchpoint on a host page.
+ */
+static int page_prot(uintptr_t page) {
+    int prot = PROT_READ | PROT_WRITE;
+    for (int i = 0; i < nwatches; i++) {
+        if (page < watches[i].page_lo || page >= watches[i].page_hi)
+            continue;
+        prot = (watches[i].mode & WATCH_READ) ? PROT_NONE : (prot & PROT_READ);
+        if (prot == PROT_NONE)
+            break;
+    }
+    return prot;
+}
+
+/**
+ * @brief Applies the watch protection to every page of a watchpoint.
+ */
+static void protect(const Watchpoint *w) {
+    for (uintptr_t p = w->page_lo; p < w->page_hi; p += page_size)
+        mprotect((void *) p, page_size, page_prot(p));
+}
+
+/**
+ * @brief Lifts the protection of every page of a watchpoint.
+ */
+static void unprotect(const Watchpoint *w) {
+    mprotect((void *) w->page_lo, w->page_hi - w->page_lo, PROT_READ | PROT_WRITE);
+}
+
+/**
+ * @brief Reads a watched range as a little-endian integer.
+ */
+static uint64_t range_value(const uint8_t *bytes, uint64_t len) {
+    uint64_t v = 0;
+    for (uint64_t i = len; i-- > 0; )
+        v = (v << 8) | bytes[i];
+    return v;
+}
+
+/**
+ * @brief How the instruction at pc, run with regs, touched w: WATCH_WRITE
+ *        for a store to it, WATCH_READ for a load from it or its fetch,
+ *        0 if it only hit another address on the same page.
+ */
+static int access_of(const Watchpoint *w, uint64_t pc, const int64_t *regs) {
+    Instruction inst = decode(mem_read_32(pc));
+    int fetched = w->addr < pc + 4 && pc < w->addr + w->len;
+    uint64_t addr, size;
+
+    if (!inst.valid || (strncmp(inst.name, "LDUR", 4) != 0 && strncmp(inst.name, "STUR", 4) != 0))
+        return fetched ? WATCH_READ : 0;
+    addr = regs[inst.Rn] + inst.imm;
+    size = inst.name[4] == 'B' ? 1 : inst.name[4] == 'H' ? 2 : 8;
+    if (w->addr < addr + size && addr < w->addr + w->len)
+        return inst.name[0] == 'S' ? WATCH_WRITE : WATCH_READ;
+    return fetched ? WATCH_READ : 0;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FAULT HANDLER
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief SIGSEGV handler: opens a watched page for the current instruction.
+ *        Faults outside watched pages fall back to the default action.
+ */
+static void watch_fault(int sig, siginfo_t *si, void *uc) {
+    uintptr_t page = (uintptr_t) si->si_addr & ~(page_size - 1);
+    int found = 0;
+
+    (void) uc;
+
+    if (!watch_pending)
+        memcpy(fault_regs, CURRENT_STATE.REGS, sizeof(fault_regs));
+    for (int i = 0; i < nwatches; i++) {
+        Watchpoint *w = &watches[i];
+        if (page < w->page_lo || page >= w->page_hi)
+            continue;
+
+        unprotect(w);
+        if (!w->touched) {
+            w->touched = 1;
+            w->pc = CURRENT_STATE.PC;
+            memcpy(w->old, w->host, w->len);
+        }
+        found = 1;
+    }
+
+    if (!found) {
+        history_crash(sig);
+        signal(SIGSEGV, SIG_DFL);  // re-fault and crash as usual
+        return;
+    }
+    watch_pending = 1;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * PUBLIC INTERFACE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Installs a watchpoint and protects its host page(s).
+ */
+int watch_add(uint64_t addr, uint64_t len, int mode) {
+    uint8_t *lo = mem_host_ptr(addr);
+    uint8_t *hi = mem_host_ptr(addr + len - 1);
+
+    if (nwatches == WATCH_MAX || len == 0 || len > WATCH_MAX_LEN || !mode)
+        return -1;
+    if (lo == NULL || hi == NULL || hi - lo != (intptr_t) (len - 1))
+        return -1;
+
+    if (page_size == 0) {
+        struct sigaction sa;
+        page_size = sysconf(_SC_PAGESIZE);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = watch_fault;
+        sa.sa_flags = SA_SIGINFO;
+        sigaction(SIGSEGV, &sa, NULL);
+    }
+
+    Watchpoint *w = &watches[nwatches];
+    memset(w, 0, sizeof(*w));
+    w->addr = addr;
+    w->len = len;
+    w->mode = mode;
+    w->host = lo;
+    w->page_lo = (uintptr_t) lo & ~(page_size - 1);
+    w->page_hi = ((uintptr_t) hi & ~(page_size - 1)) + page_size;
+    nwatches++;
+
+    if (!suspended)
+        protect(w);
+    return nwatches;
+}
+
+/**
+ * @brief Reports hits for the pages touched this cycle and protects them again.
+ */
+void watch_after_cycle() {
+    watch_pending = 0;
+    // Other watched pages may still be shut; the instruction is read below.
+    for (int i = 0; i < nwatches; i++)
+        unprotect(&watches[i]);
+
+    for (int i = 0; i < nwatches; i++) {
+        Watchpoint *w = &watches[i];
+        if (!w->touched)
+            continue;
+        w->touched = 0;
+
+        // A store counts as a write even when it leaves the bytes unchanged.
+        int access = access_of(w, w->pc, fault_regs);
+        if (access == 0 && memcmp(w->old, w->host, w->len) != 0)
+            access = WATCH_WRITE;
+        if (access == 0)
+            continue;                     // another address on the same page
+        if (!(w->mode & access))
+            continue;
+        int is_write = access == WATCH_WRITE;
+
+        printf("Watchpoint %d: %s at PC 0x%" PRIx64 "\n", i + 1,
+               is_write ? "write" : "read", w->pc);
+        printf("  [0x%" PRIx64 ", %" PRIu64 " bytes] old 0x%" PRIx64
+               " new 0x%" PRIx64 "\n\n", w->addr, w->len,
+               range_value(w->old, w->len), range_value(w->host, w->len));
+
+        if (RUN_BIT) {
+            RUN_BIT = FALSE;
+            watch_stopped = TRUE;
+        }
+    }
+
+    for (int i = 0; i < nwatches; i++)
+        protect(&watches[i]);
+}
+
+/**
+ * @brief Lifts all protections so the shell can touch memory freely.
+ */
+void watch_suspend() {
+    suspended = 1;
+    for (int i = 0; i < nwatches; i++)
+        unprotect(&watches[i]);
+}
+
+/**
+ * @brief Restores the protections lifted by watch_suspend().
+ */
+void watch_resume() {
+    suspended = 0;
+    for (int i = 0; i < nwatches; i++)
+        protect(&watches[i]);
+}
+
+// final version
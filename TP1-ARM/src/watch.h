@@ -0,0 +1,57 @@
+/**
+ * @file watch.h
+ * @brief Data watchpoints implemented with host page protection.
+ */
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <stdint.h>
+#include <signal.h>
+
+#define WATCH_READ  0x1   ///< Stop on loads from the range
+#define WATCH_WRITE 0x2   ///< Stop on stores to the range
+#define WATCH_MAX   8     ///< Maximum simultaneous watchpoints
+#define WATCH_MAX_LEN 8   ///< Widest watched range, in bytes
+
+/**
+ * @brief Set by the fault handler when a watched page was touched during
+ *        the current cycle. Checked once per cycle by the shell.
+ */
+extern volatile sig_atomic_t watch_pending;
+
+/**
+ * @brief Set when a watchpoint hit cleared RUN_BIT, so the run loop can
+ *        tell a watch stop from a real halt.
+ */
+extern int watch_stopped;
+
+/**
+ * @brief Installs a watchpoint and protects its host page(s).
+ *
+ * @param addr Guest address of the watched range.
+ * @param len  Length in bytes (1..WATCH_MAX_LEN).
+ * @param mode WATCH_READ, WATCH_WRITE or both.
+ * @return int Watchpoint number, or -1 on error.
+ */
+int watch_add(uint64_t addr, uint64_t len, int mode);
+
+/**
+ * @brief Re-protects touched pages and reports hits after a cycle.
+ *        Only called when watch_pending is set.
+ */
+void watch_after_cycle();
+
+/**
+ * @brief Lifts all protections so the shell can touch memory freely.
+ */
+void watch_suspend();
+
+/**
+ * @brief Restores the protections lifted by watch_suspend().
+ */
+void watch_resume();
+
+#endif // WATCH_H
+
+// final version
@@ -0,0 +1,296 @@
+/**
+ * @file writer.c
+ * @brief Background writer for register and memory dumps.
+ *
+ * The simulation thread only copies the state it wants dumped into a
+ * bounded queue; a writer thread formats the copies and does the I/O.
+ * Guest memory is never touched by the writer, so watchpoint protections
+ * and device reads stay on the simulation thread.
+ */
+
+#include "writer.h"
+#include "dump.h"
+#include "loader.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BYTE_ORDER_MARK 0x01020304u
+
+/**
+ * @struct Job
+ * @brief One queued dump: a register file or a copied memory range.
+ */
+typedef struct {
+    int type;                 ///< WRITER_REGS or WRITER_MEMORY
+    int where;                ///< WRITER_STDOUT / WRITER_FILE bits
+    CPU_State cpu;
+    uint64_t icount;
+    uint64_t start, stop, count;
+    uint32_t *words;          ///< Owned by the job; freed once written
+} Job;
+
+static Job queue[WRITER_QUEUE];
+static uint64_t head, tail;   ///< Next slot to fill / next slot to write
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static pthread_t thread;
+static int running, stopping;
+
+static FILE *dumpsim;
+static int binary;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * WRITING
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void write_record(uint32_t type, uint64_t size) {
+    WriterRecord r;
+
+    memset(&r, 0, sizeof(r));
+    r.type = type;
+    r.size = size;
+    fwrite(&r, sizeof(r), 1, dumpsim);
+}
+
+static void write_regs(const Job *j, const Symbol *sym) {
+    WriterRegs r;
+
+    memset(&r, 0, sizeof(r));
+    r.icount = j->icount;
+    r.pc = j->cpu.PC;
+    memcpy(r.regs, j->cpu.REGS, sizeof(r.regs));
+    r.flag_n = j->cpu.FLAG_N;
+    r.flag_z = j->cpu.FLAG_Z;
+    if (sym != NULL) {
+        r.symbol_offset = j->cpu.PC - sym->addr;
+        r.symbol_len = strlen(sym->name);
+        if (r.symbol_len > WRITER_SYMBOL_MAX)
+            r.symbol_len = WRITER_SYMBOL_MAX;
+    }
+
+    write_record(WRITER_REGS, sizeof(r) + r.symbol_len);
+    fwrite(&r, sizeof(r), 1, dumpsim);
+    if (sym != NULL)
+        fwrite(sym->name, 1, r.symbol_len, dumpsim);
+}
+
+static void write_memory(const Job *j) {
+    WriterMemory m = { j->start, j->stop, j->count };
+
+    write_record(WRITER_MEMORY, sizeof(m) + j->count * 4);
+    fwrite(&m, sizeof(m), 1, dumpsim);
+    fwrite(j->words, 4, j->count, dumpsim);
+}
+
+/**
+ * @brief Formats a job once for the text destinations and writes the
+ *        binary record when the dumpsim file is binary.
+ */
+static void write_job(Job *j) {
+    int to_file = (j->where & WRITER_FILE) && dumpsim != NULL;
+    FILE *out = (j->where & WRITER_STDOUT) ? stdout : NULL;
+    FILE *copy = to_file && !binary ? dumpsim : NULL;
+
+    if (out == NULL) {
+        out = copy;
+        copy = NULL;
+    }
+
+    if (j->type == WRITER_REGS) {
+        const Symbol *sym = symbol_lookup(j->cpu.PC);
+        if (out != NULL)
+            dump_registers(out, copy, &j->cpu, j->icount, sym ? sym->name : NULL,
+                           sym ? j->cpu.PC - sym->addr : 0);
+        if (to_file && binary)
+            write_regs(j, sym);
+    } else {
+        if (out != NULL)
+            dump_words(out, copy, j->start, j->stop, j->words);
+        if (to_file && binary)
+            write_memory(j);
+        free(j->words);
+    }
+}
+
+static void *writer_main(void *arg) {
+    (void) arg;
+
+    pthread_mutex_lock(&lock);
+    for (;;) {
+        while (head == tail && !stopping)
+            pthread_cond_wait(&ready, &lock);
+        if (head == tail)
+            break;
+
+        pthread_mutex_unlock(&lock);
+        write_job(&queue[tail % WRITER_QUEUE]);
+        pthread_mutex_lock(&lock);
+
+        tail++;
+        pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * QUEUE
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+static void enqueue(const Job *j) {
+    if (!running) {
+        Job copy = *j;
+        write_job(&copy);
+        return;
+    }
+
+    pthread_mutex_lock(&lock);
+    while (head - tail == WRITER_QUEUE)
+        pthread_cond_wait(&done, &lock);
+    queue[head % WRITER_QUEUE] = *j;
+    head++;
+    // Hand dumps over in batches: waking the writer for each one costs
+    // more than formatting it.
+    if (head - tail >= WRITER_BATCH)
+        pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+}
+
+void writer_drain() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&lock);
+    if (head != tail)
+        pthread_cond_signal(&ready);
+    while (head != tail)
+        pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
+
+static void writer_stop() {
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&lock);
+    stopping = 1;
+    pthread_cond_signal(&ready);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+    running = 0;
+}
+
+int writer_start(FILE *file, int binary_file) {
+    sigset_t all, old;
+
+    dumpsim = file;
+    binary = binary_file;
+    if (dumpsim != NULL && binary) {
+        WriterHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, WRITER_MAGIC, sizeof(WRITER_MAGIC));
+        h.version = WRITER_VERSION;
+        h.byte_order = BYTE_ORDER_MARK;
+        fwrite(&h, sizeof(h), 1, dumpsim);
+    }
+
+    // Signals (watchpoint faults aside, which are synchronous) stay with
+    // the simulation thread.
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    running = pthread_create(&thread, NULL, writer_main, NULL) == 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (!running)
+        return -1;
+    // Queued dumps are written before the process exits.
+    atexit(writer_stop);
+    return 0;
+}
+
+void writer_registers(const CPU_State *cpu, uint64_t icount, int where) {
+    Job j;
+
+    j.type = WRITER_REGS;
+    j.where = where;
+    j.cpu = *cpu;
+    j.icount = icount;
+    j.words = NULL;
+    enqueue(&j);
+}
+
+void writer_memory(uint64_t start, uint64_t stop, int where) {
+    Job j;
+
+    j.type = WRITER_MEMORY;
+    j.where = where;
+    j.start = start;
+    j.stop = stop;
+    if ((j.words = dump_copy(start, stop, &j.count)) != NULL) {
+        enqueue(&j);
+        return;
+    }
+
+    // Too big to copy: format straight from guest memory on this thread.
+    writer_drain();
+    if (where & WRITER_STDOUT)
+        dump_memory(stdout, (where & WRITER_FILE) && !binary ? dumpsim : NULL, start, stop);
+    else if ((where & WRITER_FILE) && dumpsim != NULL && !binary)
+        dump_memory(dumpsim, NULL, start, stop);
+    if ((where & WRITER_FILE) && dumpsim != NULL && binary)
+        printf("Warning: range too large for the binary dumpsim file\n\n");
+}
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * CONVERSION
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+int writer_convert(FILE *in, FILE *out) {
+    WriterHeader h;
+    WriterRecord r;
+
+    if (fread(&h, sizeof(h), 1, in) != 1 || memcmp(h.magic, WRITER_MAGIC, sizeof(WRITER_MAGIC))
+        || h.version != WRITER_VERSION || h.byte_order != BYTE_ORDER_MARK)
+        return -1;
+
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        if (r.type == WRITER_REGS) {
+            WriterRegs regs;
+            CPU_State cpu;
+            char name[WRITER_SYMBOL_MAX + 1];
+
+            if (fread(&regs, sizeof(regs), 1, in) != 1 || regs.symbol_len > WRITER_SYMBOL_MAX
+                || fread(name, 1, regs.symbol_len, in) != regs.symbol_len)
+                return -1;
+            name[regs.symbol_len] = '\0';
+
+            cpu.PC = regs.pc;
+            memcpy(cpu.REGS, regs.regs, sizeof(cpu.REGS));
+            cpu.FLAG_N = regs.flag_n;
+            cpu.FLAG_Z = regs.flag_z;
+            dump_registers(out, NULL, &cpu, regs.icount,
+                           regs.symbol_len ? name : NULL, regs.symbol_offset);
+        } else if (r.type == WRITER_MEMORY) {
+            WriterMemory m;
+            uint32_t *words;
+
+            if (fread(&m, sizeof(m), 1, in) != 1 || m.count > DUMP_COPY_MAX_WORDS
+                || (words = malloc(m.count * 4 + 4)) == NULL)
+                return -1;
+            if (fread(words, 4, m.count, in) != m.count) {
+                free(words);
+                return -1;
+            }
+            dump_words(out, NULL, m.start, m.stop, words);
+            free(words);
+        } else if (fseek(in, r.size, SEEK_CUR) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// final version
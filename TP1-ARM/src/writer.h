@@ -0,0 +1,105 @@
+/**
+ * @file writer.h
+ * @brief Background writer for register and memory dumps.
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "shell.h"
+
+#define WRITER_STDOUT 0x1   ///< Print the dump on stdout
+#define WRITER_FILE   0x2   ///< Append the dump to the dumpsim file
+
+#define WRITER_QUEUE 256    ///< Dumps that may wait before the simulator blocks
+#define WRITER_BATCH 32     ///< Queued dumps that wake the writer
+
+/**
+ * @brief Binary dumpsim file header. Records follow, each a WriterRecord
+ *        and its payload, in host byte order.
+ */
+#define WRITER_MAGIC   "ARMDUMP"
+#define WRITER_VERSION 1
+#define WRITER_REGS    1    ///< Payload: WriterRegs, then the symbol name
+#define WRITER_MEMORY  2    ///< Payload: WriterMemory, then count words
+#define WRITER_SYMBOL_MAX 255   ///< Longer symbol names are truncated
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;      ///< 0x01020304 as written by the producing host
+} WriterHeader;
+
+typedef struct {
+    uint32_t type;
+    uint32_t pad;
+    uint64_t size;            ///< Payload bytes
+} WriterRecord;
+
+typedef struct {
+    uint64_t icount;
+    uint64_t pc;
+    int64_t regs[ARM_REGS];
+    int32_t flag_n, flag_z;
+    uint64_t symbol_offset;
+    uint32_t symbol_len;      ///< 0 when the PC is not in a symbol
+    uint32_t pad;
+} WriterRegs;
+
+typedef struct {
+    uint64_t start, stop;
+    uint64_t count;
+} WriterMemory;
+
+/* ─────────────────────────────────────────────────────────────────────────────
+ * FUNCTION DECLARATIONS
+ * ───────────────────────────────────────────────────────────────────────────── */
+
+/**
+ * @brief Starts the writer thread. Until this is called, dumps are written
+ *        synchronously.
+ *
+ * @param file   dumpsim file, or NULL.
+ * @param binary Write the dumpsim file in the binary format.
+ * @return int 0 on success, -1 if the thread could not be created (dumps
+ *         stay synchronous).
+ */
+int writer_start(FILE *file, int binary);
+
+/**
+ * @brief Queues a copy of a register file for dumping.
+ *
+ * @param where WRITER_STDOUT and/or WRITER_FILE.
+ */
+void writer_registers(const CPU_State *cpu, uint64_t icount, int where);
+
+/**
+ * @brief Copies [start, stop] out of guest memory and queues it for dumping.
+ *        Ranges too large to copy are written synchronously instead.
+ *
+ * The caller suspends watchpoints around the call.
+ *
+ * @param where WRITER_STDOUT and/or WRITER_FILE.
+ */
+void writer_memory(uint64_t start, uint64_t stop, int where);
+
+/**
+ * @brief Waits until every queued dump has been written.
+ */
+void writer_drain();
+
+/**
+ * @brief Converts a binary dumpsim file to the text format.
+ *
+ * @param in  Binary dumpsim file.
+ * @param out Text destination.
+ * @return int 0 on success, -1 if in is not a binary dumpsim file or is
+ *         truncated.
+ */
+int writer_convert(FILE *in, FILE *out);
+
+#endif // WRITER_H
+
+// final version